@@ -4,7 +4,79 @@
 
 #include <stdint.h>
 
+
+//selects how bitConverter spreads bytes into bitBuffer
+#define BIT_CONVERTER_BITFIELD 0 //16 bitfield RMWs per byte
+#define BIT_CONVERTER_WORD 1 //shift and mask, 2 word RMWs per byte
+#define BIT_CONVERTER_LUT 2 //like BIT_CONVERTER_WORD, but the spread comes from a 2KB table in flash
+#define BIT_CONVERTER_BITBAND 3 //single stores to the sram bit-band alias, also used by bitSetZeros/bitSetOnes
+#ifndef BIT_CONVERTER
+#define BIT_CONVERTER BIT_CONVERTER_WORD
+#endif
+
+//selects how the frame CRC is computed, all of them give the same result
+#define CRC_ENGINE_TABLE 0 //byte at a time from a table in flash
+#define CRC_ENGINE_HW 1 //crc unit, a word at a time
+#define CRC_ENGINE_SLICE4 2 //slice-by-4 in software, a word at a time from 4KB of tables in flash
+#ifndef CRC_ENGINE
+#define CRC_ENGINE CRC_ENGINE_HW
+#endif
+
+//abort a partial frame when the input goes idle for a character time. turn this off for senders that can't output a frame without gaps
+#ifndef UART_IDLE_ABORT
+#define UART_IDLE_ABORT 1
+#endif
+
+//hold off writing bitBuffer where a draw hasn't sent the old data yet, so data can follow DRAW_ALL right away.
+//the input backs up in the uart ring while it waits, off there's no wait but the draw can show some of the new data
+#ifndef DRAW_CHASE
+#define DRAW_CHASE 1
+#endif
+
+//split bitBuffer in two, half the pixels per channel. records write one half while the other is drawn,
+//so DRAW_ALL swaps them without waiting and there's nothing to chase
+#ifndef DOUBLE_BUFFER
+#define DOUBLE_BUFFER 0
+#endif
+
+//measure the baud rate from the 'U' that starts a frame, instead of fixing it at 2Mbps. needs UART_IDLE_ABORT
+#ifndef UART_AUTOBAUD
+#define UART_AUTOBAUD 0
+#endif
+#if UART_AUTOBAUD && !UART_IDLE_ABORT
+#error UART_AUTOBAUD uses the idle line marks to tell when it has lost lock
+#endif
+
+//size of the uart dma ring, a power of 2. every 8 bytes over 128 costs a byte of BYTES_PER_CHANNEL.
+//at 4Mbps a byte lands every 160 cycles, 128 bytes only covers 320us of conversion or zeroing
+#ifndef UART_BUF_SIZE
+#if UART_AUTOBAUD
+#define UART_BUF_SIZE 512
+#else
 #define UART_BUF_SIZE 128
+#endif
+#endif
+#if UART_BUF_SIZE & (UART_BUF_SIZE - 1) || UART_BUF_SIZE < 64
+#error UART_BUF_SIZE has to be a power of 2, at least 64
+#endif
+
+//colors a SET_CHANNEL_WS2812_PALETTE record can send, 4 bytes each. entries over 16 cost BYTES_PER_CHANNEL
+//a byte for every 2, there's no RAM to spare otherwise
+#ifndef PALETTE_ENTRIES
+#define PALETTE_ENTRIES 16
+#endif
+#if PALETTE_ENTRIES < 16 || PALETTE_ENTRIES > 255
+#error PALETTE_ENTRIES has to be 16 to 255
+#endif
+
+//800 RGB or 600 RGBW/HDR, a little extra for apa102 start/end frame. that's with the default 128 byte uart ring
+//and 16 entry palette, a larger UART_BUF_SIZE or PALETTE_ENTRIES takes a byte per channel for every 8 bytes more
+#define BUFFER_BYTES_PER_CHANNEL (2408 - (UART_BUF_SIZE - 128) / 8 - (PALETTE_ENTRIES * 4 - 64 + 7) / 8)
+#if DOUBLE_BUFFER
+#define BYTES_PER_CHANNEL (BUFFER_BYTES_PER_CHANNEL / 2)
+#else
+#define BYTES_PER_CHANNEL BUFFER_BYTES_PER_CHANNEL
+#endif
 
 void setup();
 void loop() ;
@@ -27,18 +99,34 @@ extern "C" {
 #endif
 void bitSetZeros(uint32_t *dst, uint8_t channel, int size);
 void bitSetOnes(uint32_t *dst, uint8_t channel, int size);
+void bitReplicate(uint32_t *dst, uint8_t mask, int words, int copies);
 void bitConverter(uint32_t *dst, uint8_t dstBit, uint8_t *data, int size);
-#ifdef __cplusplus
-}
-#endif
+void bitConverterMask(uint32_t *dst, uint8_t mask, const uint8_t *data, int size);
+void bitXorConverter(uint32_t *dst, uint8_t channel, const uint8_t *data, int size);
+void bitTranspose8(uint32_t *dst, uint32_t lo, uint32_t hi);
+
+//converts whole pixels for one channel
+typedef void (*PixelConverter)(uint32_t *dst, uint8_t channel, const uint8_t *data, int pixels);
+PixelConverter pixelConverterFor(uint8_t numElements, uint8_t r, uint8_t g, uint8_t b, uint8_t w);
 
 void uartIsr();
+void uartDmaIsr();
 void uartResetCrc();
 uint32_t uartGetCrc();
 void uartSetup();
 void uartRead(void *dst, int size);
 uint8_t uartGetc();
+uint8_t uartPeek();
+int uartSpan(uint8_t **data);
+void uartCommit(int size);
+void uartSkip(int size);
 int uartAvailable();
+int uartIdlePending();
+void uartSkipToIdle();
+int uartAutobaud();
+#ifdef __cplusplus
+}
+#endif
 
 
 uint32_t micros();
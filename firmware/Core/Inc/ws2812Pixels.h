@@ -0,0 +1,61 @@
+#ifndef __WS2812_PIXELS_H__
+#define __WS2812_PIXELS_H__
+
+//pixel conversion for the ws2812 records in app.c, in a header of its own so test/rleTest.c runs the same code on the host
+
+#include "app.h"
+
+//converts pixels for one channel, elements go to order[] in the output. convert is the converter picked for that
+//order, or 0 to swizzle a pixel at a time. returns where the next pixel goes
+static inline uint32_t * ws2812Pixels(uint32_t *dst, uint8_t channel, PixelConverter convert, const uint8_t *order,
+		int numElements, const uint8_t *data, int pixels) {
+	int stride = 2*numElements;
+	if (channel < 8 && convert) {
+		convert(dst, channel, data, pixels);
+		return dst + pixels * stride;
+	}
+	uint8_t elements[4];
+	while (pixels--) {
+		elements[order[0]] = *data++;
+		elements[order[1]] = *data++;
+		elements[order[2]] = *data++;
+		if (numElements == 4) {
+			elements[order[3]] = *data++;
+		}
+		//this will ignore channel > 7
+		bitConverter(dst, channel, elements, numElements);
+		dst += stride;
+	}
+	return dst;
+}
+
+//holds off until bitBuffer up to end can be written
+typedef void (*Ws2812Wait)(const uint32_t *end);
+//converts pixels for the record's channel and color order, returns where the next pixel goes
+typedef uint32_t * (*Ws2812Convert)(uint32_t *dst, const uint8_t *data, int pixels);
+
+//expands runs of a SET_CHANNEL_WS2812_RLE record, each a count byte (run length - 1) followed by one pixel.
+//a run past pixelsLeft is cut short there and sets badData. returns where the next run goes
+static inline uint32_t * ws2812Runs(uint32_t *dst, uint8_t channel, int numElements, const uint8_t *data, int runs,
+		uint16_t *pixelsLeft, uint8_t *badData, Ws2812Wait wait, Ws2812Convert convert) {
+	int stride = 2*numElements;
+	while (runs--) {
+		int count = *data++ + 1;
+		if (count > *pixelsLeft) {
+			*badData = 1;
+			count = *pixelsLeft;
+		}
+		if (count) {
+			//convert the pixel once, then copy its bits down the run
+			wait(dst + count * stride);
+			convert(dst, data, 1);
+			bitReplicate(dst, 1 << channel, stride, count - 1);
+			dst += count * stride;
+			*pixelsLeft -= count;
+		}
+		data += numElements;
+	}
+	return dst;
+}
+
+#endif
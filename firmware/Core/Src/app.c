@@ -1,5 +1,6 @@
 #include "main.h"
 #include "app.h"
+#include "ws2812Pixels.h"
 #include <string.h>
 
 volatile unsigned long ms;
@@ -32,13 +33,14 @@ volatile unsigned long lastDataMs;
 //apa102 needs a start and end frame, better to write these in memory and not require it in the protocol, borrowing 2 pixels of data
 
 
-#define BYTES_PER_CHANNEL 2408 //800 RGB or 600 RGBW/HDR, a little extra for apa102 start/end frame
 #define BYTES_TOTAL (BYTES_PER_CHANNEL * 8)
-uint32_t bitBuffer[BYTES_PER_CHANNEL * 2];
+uint32_t bitBuffer[BYTES_PER_CHANNEL * 2 * (DOUBLE_BUFFER + 1)];
+//records write the back buffer while the front one is drawn. they're the same one unless DOUBLE_BUFFER is on
+static uint32_t *frontBuffer = bitBuffer;
+static uint32_t *backBuffer = bitBuffer + BYTES_PER_CHANNEL * 2 * DOUBLE_BUFFER;
 
 
 // These vars and data structures are left for reference:
-//const static char MAGIC[] = { "UPXL" }; //starts with 0x55, good for auto baud rate detection
 // frame headers look like this:
 //typedef struct {
 //	int8_t magic[4]; //"UPXL"
@@ -47,7 +49,10 @@ uint32_t bitBuffer[BYTES_PER_CHANNEL * 2];
 //} PBFrameHeader;
 
 enum RecordType {
-	SET_CHANNEL_WS2812 = 1, DRAW_ALL, SET_CHANNEL_APA102_DATA, SET_CHANNEL_APA102_CLOCK
+	SET_CHANNEL_WS2812 = 1, DRAW_ALL, SET_CHANNEL_APA102_DATA, SET_CHANNEL_APA102_CLOCK,
+	SET_CHANNELS_WS2812_INTERLEAVED, SET_CHANNELS_WS2812_MULTICAST, SET_CHANNEL_WS2812_RANGE,
+	SET_CHANNEL_WS2812_RLE, SET_CHANNEL_WS2812_PALETTE, SET_CHANNEL_WS2812_DELTA,
+	SET_CHANNELS_WS2812_FILL, SET_CHANNELS_WS2812_GRADIENT, BATCH_RECORDS, SET_WS2812_TIMING
 };
 
 typedef struct {
@@ -56,6 +61,82 @@ typedef struct {
 	uint16_t pixels;
 } PBWS2812Channel;
 
+//one set of pixels for every selected channel on every selected board
+typedef struct {
+	PBWS2812Channel ws2812Channel;
+	uint8_t boardMask; //bit n selects the board with bus id n
+	uint8_t channelMask; //bit n selects channel n on each of those boards
+} PBWS2812MulticastChannel;
+
+//rewrites some pixels of a channel that was already set up by SET_CHANNEL_WS2812
+typedef struct {
+	uint8_t numElements; //has to match the channel
+	uint8_t reserved;
+	uint16_t offset; //first pixel to write
+	uint16_t pixels;
+} PBWS2812Range;
+
+//pixels sent as runs, each a count byte (run length - 1) followed by one pixel
+typedef struct {
+	PBWS2812Channel ws2812Channel; //pixels is the total once the runs are expanded
+	uint16_t runs;
+} PBWS2812RleChannel;
+
+//a palette of colors followed by an index for each pixel
+typedef struct {
+	PBWS2812Channel ws2812Channel;
+	uint8_t paletteSize; //entries, up to PALETTE_ENTRIES
+	uint8_t indexBits; //4 or 8. 4 bit indexes are packed 2 to a byte, first pixel in the high nibble
+} PBWS2812PaletteChannel;
+
+//pixels generated on the board for every selected channel, no pixel data follows.
+//colors are RGB or RGBW like pixel data, and always take 4 bytes
+typedef struct {
+	PBWS2812MulticastChannel target;
+	uint8_t color[4];
+} PBWS2812Fill;
+
+//fades from the first color on the first pixel to the second on the last
+typedef struct {
+	PBWS2812MulticastChannel target;
+	uint8_t color[4];
+	uint8_t color2[4];
+} PBWS2812Gradient;
+
+//more records in one frame, with one CRC at the end for all of them
+typedef struct {
+	uint8_t records;
+	uint8_t flags;
+} PBBatch;
+#define BATCH_DRAW 1 //draw all channels after the batch, if the CRC is good
+
+//starts each record in a batch, in place of a frame header
+typedef struct {
+	uint8_t channel;
+	uint8_t recordType;
+	uint16_t length; //bytes of header and data that follow, lets a record this firmware doesn't know be skipped. 0 if not given
+} PBBatchRecord;
+
+//xors the pixels of a channel that was already set up by SET_CHANNEL_WS2812. the data is a series of tokens,
+//0-127 skips that many + 1 bytes, 128-255 is followed by (token & 127) + 1 bytes to xor in
+typedef struct {
+	uint8_t numElements; //has to match the channel
+	uint8_t reserved;
+	uint16_t pixels; //pixels the delta can change, no more than the channel has
+	uint16_t length; //bytes of tokens that follow
+} PBWS2812Delta;
+
+//picks the bit timing and latch time for all ws2812 channels on a board, starting with the next draw.
+//the channel bits of the frame header are ignored. a time of 0 keeps the one the profile has
+typedef struct {
+	uint8_t profile; //one of WS2812Profile
+	uint8_t reserved;
+	uint16_t latchUs;
+	uint16_t periodNs; //bit time
+	uint16_t t0hNs; //high time of a 0 bit
+	uint16_t t1hNs; //high time of a 1 bit
+} PBWS2812Timing;
+
 typedef struct {
 	uint32_t frequency;
 	uint8_t or :2, og :2, ob :2; //color orders, data on the line assumed to be RGBV (global brightness last)
@@ -85,6 +166,19 @@ uint8_t ws2812StartBits = 0;
 uint8_t apa102ClockBits = 0;
 
 volatile uint8_t drawingBusy; //set when we start drawing, cleared when dma xfer is complete
+
+//a draw goes out in one or two phases, each sending a window of every channel at its own bit time
+typedef struct {
+	uint16_t from; //window of each channel's bytes
+	uint16_t to;
+	uint16_t period; //tim1 ticks per bit
+	uint8_t ws2812StartBits; //ws2812 timing if any are set, apa102 timing otherwise
+	uint8_t apa102ClockBits;
+} DrawPhase;
+
+static DrawPhase drawPhases[2];
+static uint8_t drawPhaseCount;
+static volatile uint8_t drawPhase; //the one being sent
 //volatile uint32_t lastDrawTimer; //to allow ws2812/13 to latch, set when dma xfer is complete
 
 static inline void ledOn() {
@@ -100,6 +194,7 @@ volatile struct {
 	uint16_t frameMisses;
 	uint16_t drawCount;
 	uint16_t overDraw;
+	uint16_t frameTimeouts;
 } debugStats;
 
 //volatile uint8_t ledBrightness;
@@ -116,8 +211,59 @@ static inline uint8_t getBusId() {
 	return busId;
 }
 
+enum WS2812Profile {
+	WS2812_PROFILE_WS2812, WS2812_PROFILE_WS2812_SHORT_LATCH, WS2812_PROFILE_WS2812B_1MHZ,
+	WS2812_PROFILE_WS2813, WS2812_PROFILE_SK6812, WS2812_PROFILE_WS2811_400KHZ, WS2812_PROFILES
+};
+
+//times are in ticks of tim1, which runs at the 64Mhz core clock
+typedef struct {
+	uint16_t period;
+	uint16_t t0h;
+	uint16_t t1h;
+	uint16_t latchUs; //tim4 ticks once a microsecond
+} WS2812Timing;
+
+static const WS2812Timing ws2812Profiles[WS2812_PROFILES] = {
+	{ 80, 15, 55, 300 }, //800Khz, the latch is long enough for WS2812B-V5 and friends
+	{ 80, 15, 55, 60 }, //older WS2812 and WS2812B only need 50us to latch
+	{ 64, 18, 43, 300 }, //WS2812B with every pulse still inside the datasheet tolerances
+	{ 80, 20, 55, 300 },
+	{ 80, 19, 38, 80 },
+	{ 160, 32, 77, 60 }, //WS2811 in low speed mode
+};
+
+//the dma triggers for start, data and stop bits need room between them, and the apa102 clock goes one tick after the stop
+#define WS2812_MIN_GAP 8
+
+static WS2812Timing ws2812Timing = { 80, 15, 55, 300 };
+//a SET_WS2812_TIMING in a batch waits here for the batch CRC
+static WS2812Timing batchTimingPending;
+
+//fastest apa102 bit, in tim1 ticks. each bit takes a dma transfer for the data and one for the clock,
+//and the uart's dma and the cpu need some of the bus too. 16 ticks is 4Mhz
+#define APA102_MIN_PERIOD 16
+
+//works out the timing a record asks for, returns 0 if it's not one that can be drawn
+static int ws2812TimingFor(const PBWS2812Timing *t, WS2812Timing *out) {
+	if (t->profile >= WS2812_PROFILES)
+		return 0;
+	*out = ws2812Profiles[t->profile];
+	int ticksPerUs = SystemCoreClock / 1000000;
+	if (t->latchUs)
+		out->latchUs = t->latchUs;
+	if (t->periodNs)
+		out->period = t->periodNs * ticksPerUs / 1000;
+	if (t->t0hNs)
+		out->t0h = t->t0hNs * ticksPerUs / 1000;
+	if (t->t1hNs)
+		out->t1h = t->t1hNs * ticksPerUs / 1000;
+	return out->t0h >= WS2812_MIN_GAP && out->t1h >= out->t0h + WS2812_MIN_GAP
+			&& out->period >= out->t1h + 2 + WS2812_MIN_GAP;
+}
+
 static inline void startWs2812LatchTimer() {
-	TIM4->ARR = 300;
+	TIM4->ARR = ws2812Timing.latchUs;
 	LL_TIM_EnableCounter(TIM4);
 }
 
@@ -126,6 +272,60 @@ static inline int isWs2812LatchTimerRunning() {
 }
 
 
+//programs the timers and dma for one phase of a draw and starts it
+static void startPhase(const DrawPhase *phase) {
+	int period = phase->period;
+	ws2812StartBits = phase->ws2812StartBits;
+	apa102ClockBits = phase->apa102ClockBits;
+	TIM1->ARR = TIM2->ARR = period - 1; //64mhz / 800khz = 80 for the default ws2812 timing
+	if (ws2812StartBits) {
+		TIM1->CCR1 = 1; //ws2812 start bits
+		TIM1->CCR3 = 1 + ws2812Timing.t0h; //triggers data + zeros clocks
+		TIM1->CCR4 = 1 + ws2812Timing.t1h; //ws2812 stop bits
+		TIM2->CCR2 = 2 + ws2812Timing.t1h; //sets clock high to latch
+		TIM1->DIER = TIM_DIER_CC1DE | TIM_DIER_CC3DE | TIM_DIER_CC4DE;
+	} else {
+		//apa102 only. the start and stop bit triggers have nothing to do,
+		//so they're turned off to leave the dma for data and clock
+		TIM1->CCR3 = 1; //data + clocks low
+		TIM2->CCR2 = 1 + period/2; //sets clock high to latch, half a bit after the data
+		TIM1->DIER = TIM_DIER_CC3DE;
+	}
+	if (TIM3->PSC != period - 1) {
+		//the prescaler only loads on an update, tim3 is stopped so make one now
+		TIM3->PSC = period - 1;
+		TIM3->EGR = TIM_EGR_UG;
+	}
+
+	int bits = (phase->to - phase->from) * 8;
+
+	// tim3's prescaler matches tim1's cycle so each increment of tim3 is one bit-time
+	TIM3->ARR = bits;
+
+	//OK this is a bit weird, there's some kind of pending DMA request that will transfer immediately and shift bits by one
+	//set it up to write a zero, then set it up again
+	DMA1_Channel6->CCR &= ~DMA_CCR_EN | DMA_CCR_TCIE;
+	DMA1_Channel6->CMAR = (uint32_t) &ones;
+	DMA1_Channel6->CPAR = (uint32_t) &GPIOA->BRR;
+	DMA1_Channel6->CNDTR = 10;
+	DMA1_Channel6->CCR |= DMA_CCR_EN;
+
+	//turn it off, set up dma to transfer from bitBuffer
+	DMA1_Channel6->CCR &= ~DMA_CCR_EN;
+	DMA1_Channel6->CMAR = (uint32_t) (frontBuffer + phase->from*2);
+	DMA1_Channel6->CPAR = (uint32_t) &GPIOA->ODR;
+	DMA1_Channel6->CNDTR = bits;
+	DMA1->IFCR |= DMA_IFCR_CTCIF3;
+	DMA1_Channel6->CCR |= DMA_CCR_EN | DMA_CCR_TCIE;
+
+
+	TIM1->CNT = 0; //for some reason, tim1 doesnt restart properly unless cleared.
+	TIM2->CNT = 0;
+
+	LL_TIM_EnableCounter(TIM1);
+	LL_TIM_EnableCounter(TIM3);
+}
+
 static inline void startDrawingChannles() {
 	if (drawingBusy) {
 		debugStats.overDraw++;
@@ -136,12 +336,13 @@ static inline void startDrawingChannles() {
 	//  * the max bytes any channel wants to send and calculate TIM3 target and update dma xfer CNDTR
 	//    otherwise FPS is capped based on theoretical max bytes. was less of a problem when there was 720 bytes
 	//  * if any channel is ws2812 and latch time isn't done, then stop now
-	//  * set the ws2812StartBits for enabled ws2812 channels
-	//  * set the apa102ClockBits for enabled apa102 channels
+	//  * collect the start bits for enabled ws2812 channels
+	//  * collect the clock bits for enabled apa102 channels
 	//  * find the lowest apa102 frequency
-	ws2812StartBits = 0;
-	apa102ClockBits = 0;
-	int maxBytes = 0;
+	uint8_t startBits = 0;
+	uint8_t clockBits = 0;
+	int ws2812Bytes = 0;
+	int apa102Bytes = 0;
 	int frequency = -1;
 	for (int ch = 0; ch < 8; ch++) {
 		switch (channels[ch].type) {
@@ -152,94 +353,125 @@ static inline void startDrawingChannles() {
 					return;
 				}
 				//don't send start bits for disabled channels
-				ws2812StartBits |= 1<<ch;
+				startBits |= 1<<ch;
 			}
 			int chBytes = channels[ch].ws2812Channel.pixels * channels[ch].ws2812Channel.numElements;
-			if (chBytes > maxBytes)
-				maxBytes = chBytes;
+			if (chBytes > ws2812Bytes)
+				ws2812Bytes = chBytes;
 			break;
 		case SET_CHANNEL_APA102_DATA:
 			if (channels[ch].apa102DataChannel.frequency) {
-				int chBytes = channels[ch].apa102DataChannel.pixels * 4;
-				if (chBytes > maxBytes)
-					maxBytes = chBytes;
+				//pixels plus start and end frames
+				int chBytes = (channels[ch].apa102DataChannel.pixels + 2) * 4;
+				if (chBytes > apa102Bytes)
+					apa102Bytes = chBytes;
 				if (frequency == -1 || channels[ch].apa102DataChannel.frequency < frequency)
 					frequency = channels[ch].apa102DataChannel.frequency;
 			}
 			break;
 		case SET_CHANNEL_APA102_CLOCK:
 			if (channels[ch].apa102ClockChannel.frequency) {
-				apa102ClockBits |= 1<<ch;
+				clockBits |= 1<<ch;
 				if (frequency == -1 || channels[ch].apa102ClockChannel.frequency < frequency)
 					frequency = channels[ch].apa102ClockChannel.frequency;
 			}
 			break;
 		}
 	}
-
-//	frequency = 2000000;
-//
-//	//ws2812 clock overrides anything else
-//	if (ws2812StartBits || frequency <= 0) {
-		frequency = 800000;
-		TIM1->ARR = TIM2->ARR = 79; //64mhz / 800khz = 80
-		TIM1->CCR1 = 1; //ws2812 start bits
-		TIM1->CCR3 = 16; //triggers data + zeros clocks
-		TIM1->CCR4 = 56; //ws2812 stop bits
-		TIM2->CCR2 = 57; //sets clock high to latch
-//	} else {
-//		int reload = (SystemCoreClock / frequency) - 1;
-//		if (reload < 4)
-//			reload = 4;
-//		TIM1->ARR = TIM2->ARR = reload;
-//		TIM1->CCR1 = 2; //does this fire?
-//		TIM1->CCR3 = 1; //triggers data + zeros clocks
-//		TIM1->CCR4 = 3; //does this fire?
-//		TIM2->CCR2 = TIM1->ARR>>1; //sets clock high to latch
-//	}
-
-	int maxBits = maxBytes *8;
+	if (frequency <= 0)
+		apa102Bytes = 0;
+
+	//ws2812 data starts at the front of each channel and apa102 data ends at the back, with zeros
+	//in between. when the two don't overlap, the ws2812 window is drawn first and the apa102 window
+	//after it at the apa102 clock. otherwise everything is drawn at the ws2812 bit time
+	int apa102From = BYTES_PER_CHANNEL - apa102Bytes;
+	drawPhaseCount = 0;
+	if (ws2812Bytes && apa102Bytes && ws2812Bytes > apa102From) {
+		drawPhases[0] = (DrawPhase) { 0, BYTES_PER_CHANNEL, ws2812Timing.period, startBits, clockBits };
+		drawPhaseCount = 1;
+	} else {
+		if (ws2812Bytes)
+			drawPhases[drawPhaseCount++] = (DrawPhase) { 0, ws2812Bytes, ws2812Timing.period, startBits, 0 };
+		if (apa102Bytes) {
+			//clock as fast as the slowest channel asked for
+			int period = (SystemCoreClock + frequency - 1) / frequency;
+			if (period < APA102_MIN_PERIOD)
+				period = APA102_MIN_PERIOD;
+			if (period > 65535)
+				period = 65535;
+			drawPhases[drawPhaseCount++] = (DrawPhase) { apa102From, BYTES_PER_CHANNEL, period, 0, clockBits };
+		}
+	}
 
 	//all channels have length of zero!
-	if (maxBits == 0)
+	if (drawPhaseCount == 0)
 		return;
 
 	debugStats.drawCount++;
 	drawingBusy = 1;
+	drawPhase = 0;
 
-	// tim3's prescaler matches tim1's cycle so each increment of tim3 is one bit-time
-	TIM3->ARR = maxBits;
-
-	//OK this is a bit weird, there's some kind of pending DMA request that will transfer immediately and shift bits by one
-	//set it up to write a zero, then set it up again
-	DMA1_Channel6->CCR &= ~DMA_CCR_EN | DMA_CCR_TCIE;
-	DMA1_Channel6->CMAR = (uint32_t) &ones;
-	DMA1_Channel6->CPAR = (uint32_t) &GPIOA->BRR;
-	DMA1_Channel6->CNDTR = 10;
-	DMA1_Channel6->CCR |= DMA_CCR_EN;
+#if DOUBLE_BUFFER
+	uint32_t *drawn = frontBuffer;
+	frontBuffer = backBuffer;
+	backBuffer = drawn;
+#endif
 
-	//turn it off, set up dma to transfer from bitBuffer
-	DMA1_Channel6->CCR &= ~DMA_CCR_EN;
-	DMA1_Channel6->CMAR = (uint32_t) &bitBuffer;
-	DMA1_Channel6->CPAR = (uint32_t) &GPIOA->ODR;
-	DMA1_Channel6->CNDTR = maxBits;
-	DMA1->IFCR |= DMA_IFCR_CTCIF3;
-	DMA1_Channel6->CCR |= DMA_CCR_EN | DMA_CCR_TCIE;
+	startPhase(&drawPhases[0]);
 
+#if DOUBLE_BUFFER
+	//records build on the frame that's being drawn, same as with one buffer. reading it doesn't get in the draw's way
+	memcpy(backBuffer, frontBuffer, BYTES_PER_CHANNEL * 8);
+#endif
 
-	TIM1->CNT = 0; //for some reason, tim1 doesnt restart properly unless cleared.
-	TIM2->CNT = 0;
+//	__WFI();
 
-	LL_TIM_EnableCounter(TIM1);
-	LL_TIM_EnableCounter(TIM3);
+}
 
-//	__WFI();
+//1 if bitBuffer can be written up to end without the current draw sending any of the new data.
+//dma sends a byte of bitBuffer per bit time, so anything before CNDTR's position has already gone out
+static inline int drawReady(const uint32_t *end) {
+#if DRAW_CHASE && !DOUBLE_BUFFER
+	if (!drawingBusy)
+		return 1;
+	//windows are in channel bytes, each of which is 8 bytes of bitBuffer and 8 dma transfers
+	int bytes = (const uint8_t *) end - (const uint8_t *) frontBuffer;
+	int phase = drawPhase;
+	int left = DMA1_Channel6->CNDTR;
+	//the isr moved on to the next phase in between, CNDTR belongs to that one. try again
+	if (phase != drawPhase)
+		return 0;
+	//a phase that's still to come sends all of its window
+	if (phase + 1 < drawPhaseCount && bytes > drawPhases[phase + 1].from * 8)
+		return 0;
+	int to = drawPhases[phase].to * 8;
+	if (bytes > to)
+		bytes = to;
+	return bytes <= to - left;
+#else
+	return 1;
+#endif
+}
 
+//waits for the draw to get past end before writing up to it
+static inline void drawWait(const uint32_t *end) {
+	while (!drawReady(end))
+		;
 }
 
 void drawingComplete() {
-	drawingBusy = 0; //technically only data xfer is done, but we are still going to clear the last bit when tim1 cc3 fires
-	startWs2812LatchTimer();
+	//technically only data xfer is done, but we are still going to clear the last bit when tim1 cc3 fires
+	if (drawPhases[drawPhase].ws2812StartBits)
+		startWs2812LatchTimer();
+	if (drawPhase + 1 < drawPhaseCount) {
+		//tim3 stops itself at the end of the last bit, at most a bit time from now
+		while (LL_TIM_IsEnabledCounter(TIM3))
+			;
+		drawPhase++;
+		startPhase(&drawPhases[drawPhase]);
+		return;
+	}
+	drawingBusy = 0;
 //	ledOff();
 }
 
@@ -285,7 +517,7 @@ void setup() {
 	//for ws2812 this either continues the pulse or turns it into a short one
 	//for apa102 data, this is the data bit
 	//for apa102 clock, data is zeroed and this will lower the clock pin
-	DMA1_Channel6->CMAR = (uint32_t) &bitBuffer;
+	DMA1_Channel6->CMAR = (uint32_t) frontBuffer;
 	DMA1_Channel6->CPAR = (uint32_t) &GPIOA->ODR;
 	//enable later
 //	DMA1_Channel6->CCR |= DMA_CCR_EN; // | DMA_CCR_TCIE;
@@ -313,245 +545,1134 @@ void setup() {
 
 }
 
-// this is the main uart scan function. It ignores data until the magic UPXL string is seen
-static inline void handleIncomming() {
-	uartResetCrc();
-	//look for the 4 byte magic header sequence
-	if (uartGetc() == 'U' && uartGetc() == 'P' && uartGetc() == 'X' && uartGetc() == 'L') {
-		uint8_t channel = uartGetc();
-		uint8_t recordType = uartGetc();
-		switch (recordType) {
-		case SET_CHANNEL_WS2812: {
-			//read in the header
-			PBWS2812Channel ch;
-			uartRead(&ch, sizeof(PBWS2812Channel));
-
-			if (ch.numElements < 3 || ch.numElements > 4)
-				return;
-			if (ch.pixels * ch.numElements > BYTES_PER_CHANNEL)
-				return;
+//blocks at the end of each channel that still need to be zeroed.
+//this is done in the background when there's no data to parse
+static uint16_t zerosPending[8];
+//apa102 data sits at the end of its channel, so its zeros go at the start instead. a bit for each channel
+static uint8_t zerosAtStart;
+
+//zero up to maxBlocks of the channel's queue, returns 0 if there was nothing to do or the draw is in the way
+static int runChannelZeros(uint8_t channel, int maxBlocks, int wait) {
+	int blocks = zerosPending[channel];
+	if (!blocks)
+		return 0;
+	if (blocks > maxBlocks)
+		blocks = maxBlocks;
+	uint32_t *dst;
+	if (zerosAtStart & (1 << channel))
+		dst = backBuffer + (zerosPending[channel] - blocks)*2;
+	else
+		dst = backBuffer + (BYTES_PER_CHANNEL - zerosPending[channel])*2;
+	if (wait)
+		drawWait(dst + blocks*2);
+	else if (!drawReady(dst + blocks*2))
+		return 0;
+	bitSetZeros(dst, channel, blocks);
+	zerosPending[channel] -= blocks;
+	return 1;
+}
 
-			//check that it's one of ours
-			//TODO handle broadcast?
-			if (channel >> 3 != getBusId()) {
-				//follow along, but ignore data
-				channel = 0xff;
-			} else {
-				channel = 7 - (channel & 7); //channel outputs are reverse numbered
-				ledOn();
-			}
+//zeros queued on the other side of the channel are done now, before the side changes
+static void zerosSide(uint8_t channel, int atStart) {
+	if (!(zerosAtStart & (1 << channel)) == !atStart)
+		return;
+	while (runChannelZeros(channel, BYTES_PER_CHANNEL, 1))
+		;
+	zerosAtStart ^= 1 << channel;
+}
 
-			uint8_t or = ch.or;
-			uint8_t og = ch.og;
-			uint8_t ob = ch.ob;
-			uint8_t ow = ch.ow;
-
-			uint8_t elements[4];
-
-			uint32_t * dst = bitBuffer;
-			int stride = 2*ch.numElements;
-			for (int i = 0; i < ch.pixels; i++) {
-				elements[or] = uartGetc();
-				elements[og] = uartGetc();
-				elements[ob] = uartGetc();
-				if (ch.numElements == 4) {
-					elements[ow] = uartGetc();
-				}
-				//this will ignore channel > 7
-				bitConverter(dst, channel, elements, ch.numElements);
-				dst += stride;
-			}
+//zero the last blocks of this channel, or the first ones
+static void queueZeros(uint8_t channel, int blocks, int atStart) {
+	if (blocks >= BYTES_PER_CHANNEL)
+		zerosPending[channel] = 0; //all of it, whatever side
+	zerosSide(channel, atStart);
+	if (blocks > zerosPending[channel])
+		zerosPending[channel] = blocks;
+}
+
+//a record is about to write the channel up to block, or from the end back to block, so the queue doesn't have to
+static void skipZeros(uint8_t channel, int block, int atStart) {
+	zerosSide(channel, atStart);
+	if (zerosPending[channel] > BYTES_PER_CHANNEL - block)
+		zerosPending[channel] = block < BYTES_PER_CHANNEL ? BYTES_PER_CHANNEL - block : 0;
+}
+
+//zero up to maxBlocks of queued data, returns 0 when there was nothing left to do.
+//in the background it's done only where the draw has already been, in a flush it waits for the draw
+static int runZeros(int maxBlocks, int wait) {
+	for (int ch = 0; ch < 8; ch++) {
+		if (zerosPending[ch])
+			return runChannelZeros(ch, maxBlocks, wait);
+	}
+	return 0;
+}
+
+//anything queued has to be done before it's drawn
+static void flushZeros() {
+	while (runZeros(BYTES_PER_CHANNEL, 1))
+		;
+}
 
-			volatile uint32_t crcExpected = uartGetCrc();
-			volatile uint32_t crcRead;
-			uartRead((void *) &crcRead, sizeof(crcRead));
+const static char MAGIC[] = { "UPXL" }; //starts with 0x55, good for auto baud rate detection
 
+enum ParserState {
+	PARSE_MAGIC, PARSE_FRAME_HEADER, PARSE_RECORD_HEADER, PARSE_DATA, PARSE_CRC, PARSE_SKIP, PARSE_BATCH_RECORD
+};
+
+//everything needed to pick up where the parser left off when it runs out of data mid frame
+static struct {
+	uint8_t state;
+	uint8_t magicPos;
+	uint8_t frameChannel; //as received in the frame header
+	uint8_t channel; //output bit, or 0xff if the frame is for another board
+	uint8_t outputMask; //output bits for a multicast record
+	uint8_t recordType;
+	int8_t headerSize;
+	uint8_t unitSize; //data is handled in whole units, like a pixel, up to 32 bytes
+	uint16_t units; //units of data left
+	uint32_t skipBytes; //left to skip in a frame for another board. wide enough for any header's count times its unit
+	uint16_t pixelsLeft; //pixels the runs of an RLE record haven't covered yet
+	uint8_t badData; //set when the data doesn't add up, like RLE runs past the end or a palette index out of range
+	uint8_t phase; //which part of the data is coming in, for records with more than one
+	uint8_t paletteCount; //entries of a palette record received so far
+	uint8_t element; //element of the pixel at dst a delta record is on
+	uint8_t literalLeft; //bytes left to xor in from the current delta token
+	uint16_t bytesLeft; //pixel bytes a delta record can still change
+	uint8_t batchLeft; //records left in the batch, including the current one. 0 outside of a batch
+	uint8_t batchFlags;
+	uint8_t batchOutputs; //output bits the batch has written so far, thrown out if its CRC doesn't match
+	uint8_t batchTiming; //set when the batch had a SET_WS2812_TIMING for this board, in batchTimingPending
+	uint8_t timedOut; //set while a frame cut short by the line going idle is thrown out
+	uint32_t *dst;
+	PixelConverter convert;
+	union {
+		PBWS2812Channel ws2812Channel;
+		PBWS2812MulticastChannel ws2812MulticastChannel; //starts with the same PBWS2812Channel
+		PBWS2812Range ws2812Range;
+		PBWS2812RleChannel ws2812RleChannel; //starts with the same PBWS2812Channel
+		PBWS2812PaletteChannel ws2812PaletteChannel; //starts with the same PBWS2812Channel
+		PBWS2812Delta ws2812Delta;
+		PBWS2812Fill ws2812Fill; //these start with the same PBWS2812MulticastChannel
+		PBWS2812Gradient ws2812Gradient;
+		PBBatch batch;
+		PBWS2812Timing ws2812Timing;
+		PBAPA102DataChannel apa102DataChannel;
+		PBAPA102ClockChannel apa102ClockChannel;
+	};
+} parser;
+
+//a frame that failed its CRC. one that timed out is counted in frameTimeouts instead
+static inline void countCrcError() {
+	if (!parser.timedOut)
+		debugStats.crcErrors++;
+}
+
+//palette for SET_CHANNEL_WS2812_PALETTE, kept in output color order so a pixel converts straight from its entry.
+//it's sent with every record, there's only room to hold one
+static uint8_t palette[PALETTE_ENTRIES][4];
+
+//check that it's one of ours, returns the output bit or 0xff to follow along but ignore data
+static inline uint8_t ourChannel(uint8_t channel) {
+	if (channel >> 3 != getBusId())
+		return 0xff;
+	ledOn();
+	return 7 - (channel & 7); //channel outputs are reverse numbered
+}
+
+//output bits for the channels a multicast record selects on this board, 0 if none
+static inline uint8_t ourOutputs(uint8_t boardMask, uint8_t channelMask) {
+	if (!(boardMask & (1 << getBusId())))
+		return 0;
+	ledOn();
+	return __RBIT(channelMask) >> 24; //channel outputs are reverse numbered
+}
+
+//size of the structure after the frame header, or -1 for an unsupported record
+static int recordHeaderSize(uint8_t recordType) {
+	switch (recordType) {
+	case SET_CHANNEL_WS2812:
+	case SET_CHANNELS_WS2812_INTERLEAVED:
+		return sizeof(PBWS2812Channel);
+	case DRAW_ALL:
+		return 0;
+	case SET_CHANNEL_APA102_DATA:
+		return sizeof(PBAPA102DataChannel);
+	case SET_CHANNEL_APA102_CLOCK:
+		return sizeof(PBAPA102ClockChannel);
+	case SET_CHANNELS_WS2812_MULTICAST:
+		return sizeof(PBWS2812MulticastChannel);
+	case SET_CHANNEL_WS2812_RANGE:
+		return sizeof(PBWS2812Range);
+	case SET_CHANNEL_WS2812_RLE:
+		return sizeof(PBWS2812RleChannel);
+	case SET_CHANNEL_WS2812_PALETTE:
+		return sizeof(PBWS2812PaletteChannel);
+	case SET_CHANNEL_WS2812_DELTA:
+		return sizeof(PBWS2812Delta);
+	case SET_CHANNELS_WS2812_FILL:
+		return sizeof(PBWS2812Fill);
+	case SET_CHANNELS_WS2812_GRADIENT:
+		return sizeof(PBWS2812Gradient);
+	case BATCH_RECORDS:
+		return sizeof(PBBatch);
+	case SET_WS2812_TIMING:
+		return sizeof(PBWS2812Timing);
+	default:
+		return -1;
+	}
+}
+
+//this frame is for another board, jump over its data and CRC without looking at them.
+//a record in a batch has no CRC of its own
+static int skipRecord(int bytes) {
+	parser.skipBytes = parser.batchLeft ? bytes : bytes + 4;
+	return PARSE_SKIP;
+}
+
+static int recordDone();
+static void recordEnd(int crcOk);
+
+//called once the record's header is in, sets up the data that follows. returns the next parser state
+static int recordBegin() {
+	parser.units = 0;
+	parser.dst = backBuffer;
+	switch (parser.recordType) {
+	case SET_CHANNEL_WS2812: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		if (ch->numElements < 3 || ch->numElements > 4)
+			return PARSE_MAGIC;
+		if (ch->pixels * ch->numElements > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		parser.channel = ourChannel(parser.frameChannel);
+		if (parser.channel > 7)
+			return skipRecord(ch->pixels * ch->numElements);
+		parser.unitSize = ch->numElements;
+		parser.units = ch->pixels;
+		//picked once per record, the color order and element count are baked in
+		parser.convert = pixelConverterFor(ch->numElements, ch->or, ch->og, ch->ob, ch->ow);
+		skipZeros(parser.channel, ch->pixels * ch->numElements, 0);
+		break;
+	}
+	case SET_CHANNEL_WS2812_RANGE: {
+		PBWS2812Range range = parser.ws2812Range;
+		if (range.numElements < 3 || range.numElements > 4)
+			return PARSE_MAGIC;
+		if ((range.offset + range.pixels) * range.numElements > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		parser.channel = ourChannel(parser.frameChannel);
+		if (parser.channel > 7)
+			return skipRecord(range.pixels * range.numElements);
+		//the range has to fit in what the channel is already set up for, otherwise there's nothing to update
+		PBWS2812Channel *cfg = &channels[parser.channel].ws2812Channel;
+		if (channels[parser.channel].type != SET_CHANNEL_WS2812 || cfg->numElements != range.numElements
+				|| range.offset + range.pixels > cfg->pixels) {
+			ledOff();
+			parser.channel = 0xff;
+			return skipRecord(range.pixels * range.numElements);
+		}
+		//from here on it converts like SET_CHANNEL_WS2812, with the channel's own color order
+		parser.ws2812Channel = *cfg;
+		parser.ws2812Channel.pixels = range.pixels;
+		parser.unitSize = cfg->numElements;
+		parser.units = range.pixels;
+		parser.dst += range.offset * cfg->numElements * 2;
+		parser.convert = pixelConverterFor(cfg->numElements, cfg->or, cfg->og, cfg->ob, cfg->ow);
+		break;
+	}
+	case SET_CHANNEL_APA102_DATA: {
+		PBAPA102DataChannel *ch = &parser.apa102DataChannel;
+		if (ch->frequency == 0)
+			return PARSE_MAGIC;
+		//make sure we're not getting more data than we can handle
+		if ((ch->pixels+2) * 4 > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		parser.channel = ourChannel(parser.frameChannel);
+		if (parser.channel > 7)
+			return skipRecord(ch->pixels * 4);
+		parser.unitSize = 4;
+		parser.units = ch->pixels;
+		//ends at the end of the channel, so it can be drawn in its own window after any ws2812 data
+		parser.dst += (BYTES_PER_CHANNEL - (ch->pixels+2) * 4) * 2;
+		skipZeros(parser.channel, (ch->pixels+2) * 4, 1);
+
+		//start frame
+		uint8_t elements[4] = {0,0,0,0};
+		drawWait(parser.dst + 8);
+		bitConverter(parser.dst, parser.channel, elements, 4);
+		parser.dst += 8;
+
+		//end frame
+		elements[0] = 0xff;
+		drawWait(parser.dst + ch->pixels * 8 + 8);
+		bitConverter(parser.dst + ch->pixels * 8, parser.channel, elements, 4);
+		break;
+	}
+	case SET_CHANNEL_APA102_CLOCK:
+		if (parser.apa102ClockChannel.frequency == 0)
+			return PARSE_MAGIC;
+		parser.channel = ourChannel(parser.frameChannel);
+		if (parser.channel > 7)
+			return skipRecord(0);
+		break;
+	case SET_CHANNELS_WS2812_INTERLEAVED: {
+		//one header for all 8 channels of a board, followed by 8 byte slots with one byte for each channel
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		if (ch->numElements < 3 || ch->numElements > 4)
+			return PARSE_MAGIC;
+		if (ch->pixels * ch->numElements > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		//only the board bits of the channel are used, follow along if it isn't ours
+		parser.channel = ourChannel(parser.frameChannel & ~7);
+		if (parser.channel > 7)
+			return skipRecord(8 * ch->numElements * ch->pixels);
+		parser.unitSize = 8 * ch->numElements;
+		parser.units = ch->pixels;
+		for (int c = 0; c < 8; c++)
+			skipZeros(c, ch->pixels * ch->numElements, 0);
+		break;
+	}
+	case SET_CHANNEL_WS2812_RLE: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		if (ch->numElements < 3 || ch->numElements > 4)
+			return PARSE_MAGIC;
+		if (ch->pixels * ch->numElements > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		//every run covers at least a pixel
+		if (parser.ws2812RleChannel.runs > ch->pixels)
+			return PARSE_MAGIC;
+		parser.channel = ourChannel(parser.frameChannel);
+		if (parser.channel > 7)
+			return skipRecord(parser.ws2812RleChannel.runs * (ch->numElements + 1));
+		parser.unitSize = ch->numElements + 1;
+		parser.units = parser.ws2812RleChannel.runs;
+		parser.pixelsLeft = ch->pixels;
+		parser.badData = 0;
+		parser.convert = pixelConverterFor(ch->numElements, ch->or, ch->og, ch->ob, ch->ow);
+		skipZeros(parser.channel, ch->pixels * ch->numElements, 0);
+		break;
+	}
+	case SET_CHANNEL_WS2812_PALETTE: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		PBWS2812PaletteChannel *pal = &parser.ws2812PaletteChannel;
+		if (ch->numElements < 3 || ch->numElements > 4)
+			return PARSE_MAGIC;
+		if (ch->pixels * ch->numElements > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		if ((pal->indexBits != 4 && pal->indexBits != 8) || pal->paletteSize == 0
+				|| pal->paletteSize > PALETTE_ENTRIES || pal->paletteSize > 1 << pal->indexBits)
+			return PARSE_MAGIC;
+		parser.channel = ourChannel(parser.frameChannel);
+		if (parser.channel > 7)
+			return skipRecord(pal->paletteSize * ch->numElements + (ch->pixels * pal->indexBits + 7) / 8);
+		//the palette comes in first, a whole entry at a time
+		parser.unitSize = ch->numElements;
+		parser.units = pal->paletteSize;
+		parser.phase = 0;
+		parser.paletteCount = 0;
+		parser.pixelsLeft = ch->pixels;
+		parser.badData = 0;
+		skipZeros(parser.channel, ch->pixels * ch->numElements, 0);
+		break;
+	}
+	case SET_CHANNEL_WS2812_DELTA: {
+		PBWS2812Delta delta = parser.ws2812Delta;
+		if (delta.numElements < 3 || delta.numElements > 4)
+			return PARSE_MAGIC;
+		if (delta.pixels * delta.numElements > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		parser.channel = ourChannel(parser.frameChannel);
+		if (parser.channel > 7)
+			return skipRecord(delta.length);
+		//a delta only makes sense against what the channel already has
+		PBWS2812Channel *cfg = &channels[parser.channel].ws2812Channel;
+		if (channels[parser.channel].type != SET_CHANNEL_WS2812 || cfg->numElements != delta.numElements
+				|| delta.pixels > cfg->pixels) {
 			ledOff();
-			if (channel < 8) {
-				int blocksToZero;
-				if (crcExpected == crcRead) {
-					if (channels[channel].type == SET_CHANNEL_WS2812
-							&& (ch.pixels * ch.numElements >=
-									channels[channel].ws2812Channel.pixels * channels[channel].ws2812Channel.numElements)
-						) {
-						blocksToZero = 0;
-					} else {
-						//we need to zero out previous data if the data received was less than last time
-						blocksToZero = BYTES_PER_CHANNEL - ch.numElements * ch.pixels;
-					}
-
-					channels[channel].type = SET_CHANNEL_WS2812;
-					channels[channel].ws2812Channel = ch;
-
-					lastDataMs = ms;
+			parser.channel = 0xff;
+			return skipRecord(delta.length);
+		}
+		parser.ws2812Channel = *cfg;
+		parser.unitSize = 1;
+		parser.units = delta.length;
+		parser.element = 0;
+		parser.literalLeft = 0;
+		parser.bytesLeft = delta.pixels * delta.numElements;
+		parser.badData = 0;
+		break;
+	}
+	case SET_CHANNELS_WS2812_FILL:
+	case SET_CHANNELS_WS2812_GRADIENT: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		if (ch->numElements < 3 || ch->numElements > 4)
+			return PARSE_MAGIC;
+		if (ch->pixels * ch->numElements > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		//nothing to convert until the CRC says the colors are good
+		parser.outputMask = ourOutputs(parser.ws2812MulticastChannel.boardMask, parser.ws2812MulticastChannel.channelMask);
+		if (!parser.outputMask)
+			return skipRecord(0);
+		break;
+	}
+	case SET_CHANNELS_WS2812_MULTICAST: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		if (ch->numElements < 3 || ch->numElements > 4)
+			return PARSE_MAGIC;
+		if (ch->pixels * ch->numElements > BYTES_PER_CHANNEL)
+			return PARSE_MAGIC;
+		parser.outputMask = ourOutputs(parser.ws2812MulticastChannel.boardMask, parser.ws2812MulticastChannel.channelMask);
+		if (!parser.outputMask)
+			return skipRecord(ch->pixels * ch->numElements);
+		parser.unitSize = ch->numElements;
+		parser.units = ch->pixels;
+		for (int c = 0; c < 8; c++) {
+			if (parser.outputMask & (1 << c))
+				skipZeros(c, ch->pixels * ch->numElements, 0);
+		}
+		break;
+	}
+	case SET_WS2812_TIMING: {
+		WS2812Timing timing;
+		if (!ws2812TimingFor(&parser.ws2812Timing, &timing))
+			return PARSE_MAGIC;
+		parser.channel = ourChannel(parser.frameChannel);
+		if (parser.channel > 7)
+			return skipRecord(0);
+		break;
+	}
+	case BATCH_RECORDS:
+		parser.batchFlags = parser.batch.flags;
+		parser.batchOutputs = 0;
+		parser.batchTiming = 0;
+		parser.batchLeft = parser.batch.records;
+		return parser.batchLeft ? PARSE_BATCH_RECORD : PARSE_CRC;
+	default:
+		break;
+	}
+	return parser.units ? PARSE_DATA : recordDone();
+}
+
+//converts ws2812 pixels for the record's channel and color order, returns where the next pixel goes
+static uint32_t * ws2812Convert(uint32_t *dst, const uint8_t *data, int pixels) {
+	PBWS2812Channel *ch = &parser.ws2812Channel;
+	drawWait(dst + pixels * 2*ch->numElements);
+	const uint8_t order[4] = { ch->or, ch->og, ch->ob, ch->ow };
+	return ws2812Pixels(dst, parser.channel, parser.convert, order, ch->numElements, data, pixels);
+}
+
+//converts one pixel of a palette record
+static inline uint32_t * palettePixel(uint32_t *dst, uint8_t index) {
+	if (parser.pixelsLeft == 0)
+		return dst;
+	parser.pixelsLeft--;
+	drawWait(dst + 2*parser.ws2812Channel.numElements);
+	if (index < parser.ws2812PaletteChannel.paletteSize)
+		bitConverter(dst, parser.channel, palette[index], parser.ws2812Channel.numElements);
+	else
+		parser.badData = 1;
+	return dst + 2*parser.ws2812Channel.numElements;
+}
+
+//moves a delta record ahead by bytes of pixel data
+static void deltaAdvance(int bytes) {
+	if (bytes > parser.bytesLeft) {
+		parser.badData = 1;
+		bytes = parser.bytesLeft;
+	}
+	parser.bytesLeft -= bytes;
+	int numElements = parser.ws2812Channel.numElements;
+	int element = parser.element + bytes;
+	parser.dst += 2*numElements * (element / numElements);
+	parser.element = element % numElements;
+}
+
+//converts units worth of data
+static void recordData(const uint8_t *data, int units) {
+	switch (parser.recordType) {
+	case SET_CHANNEL_WS2812:
+	case SET_CHANNEL_WS2812_RANGE:
+		parser.dst = ws2812Convert(parser.dst, data, units);
+		break;
+	case SET_CHANNEL_WS2812_RLE:
+		parser.dst = ws2812Runs(parser.dst, parser.channel, parser.ws2812Channel.numElements, data, units,
+				&parser.pixelsLeft, &parser.badData, drawWait, ws2812Convert);
+		break;
+	case SET_CHANNEL_WS2812_PALETTE: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		if (parser.phase == 0) {
+			//swizzled once here instead of for every pixel that uses it
+			while (units--) {
+				uint8_t *entry = palette[parser.paletteCount++];
+				entry[ch->or] = *data++;
+				entry[ch->og] = *data++;
+				entry[ch->ob] = *data++;
+				if (ch->numElements == 4)
+					entry[ch->ow] = *data++;
+			}
+		} else {
+			uint32_t * dst = parser.dst;
+			while (units--) {
+				uint8_t in = *data++;
+				if (parser.ws2812PaletteChannel.indexBits == 8) {
+					dst = palettePixel(dst, in);
 				} else {
-					//garbage data, disable the channel, zero everything.
-					//its better to let the LEDs keep the previous values than draw garbage.
-					debugStats.crcErrors++;
-					channels[channel].type = SET_CHANNEL_WS2812;
-					memset(&channels[channel].ws2812Channel, 0, sizeof(channels[0].ws2812Channel));
-					blocksToZero = BYTES_PER_CHANNEL;
+					dst = palettePixel(dst, in >> 4);
+					dst = palettePixel(dst, in & 0xf);
 				}
-				//zero out any remaining data in the buffer for this channel
-				if (blocksToZero > 0)
-					bitSetZeros(bitBuffer + (BYTES_PER_CHANNEL - blocksToZero)*2, channel, blocksToZero);
 			}
-			break;
+			parser.dst = dst;
 		}
-		case DRAW_ALL: {
-			uint32_t crcExpected = uartGetCrc();
-			uint32_t crcRead;
-			uartRead(&crcRead, sizeof(crcRead));
-			if (crcExpected == crcRead) {
-				startDrawingChannles();
+		break;
+	}
+	case SET_CHANNEL_WS2812_DELTA: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		uint8_t order[4] = {ch->or, ch->og, ch->ob, ch->ow};
+		while (units--) {
+			uint8_t in = *data++;
+			if (parser.literalLeft) {
+				parser.literalLeft--;
+				if (parser.bytesLeft == 0) {
+					parser.badData = 1;
+				} else {
+					//only the bits that change get flipped, everything else is left as it was
+					drawWait(parser.dst + 2*order[parser.element] + 2);
+					bitXorConverter(parser.dst + 2*order[parser.element], parser.channel, &in, 1);
+					deltaAdvance(1);
+				}
+			} else if (in & 0x80) {
+				parser.literalLeft = (in & 0x7f) + 1;
 			} else {
-				debugStats.crcErrors++;
+				deltaAdvance(in + 1);
 			}
-			break;
 		}
-		case SET_CHANNEL_APA102_DATA: {
-			//read in the header
-			PBAPA102DataChannel ch;
-			uartRead(&ch, sizeof(ch));
-			if (ch.frequency == 0)
-				return;
-			//make sure we're not getting more data than we can handle
-			if ((ch.pixels+2) * 4 > BYTES_PER_CHANNEL)
-				return;
-
-			//check that it's one of ours
-			//TODO handle broadcast?
-			if (channel >> 3 != getBusId()) {
-				//follow along, but ignore data
-				channel = 0xff;
-			} else {
-				channel = 7 - (channel & 7); //channel outputs are reverse numbered
-				ledOn();
+		break;
+	}
+	case SET_CHANNEL_APA102_DATA: {
+		PBAPA102DataChannel *ch = &parser.apa102DataChannel;
+		uint8_t or = ch->or;
+		uint8_t og = ch->og;
+		uint8_t ob = ch->ob;
+		uint8_t elements[4];
+		uint32_t * dst = parser.dst;
+		drawWait(dst + units * 8);
+		while (units--) {
+			elements[or+1] = *data++;
+			elements[og+1] = *data++;
+			elements[ob+1] = *data++;
+			elements[0] = *data++ | 0xe0;
+			bitConverter(dst, parser.channel, elements, 4);
+			dst += 8;
+		}
+		parser.dst = dst;
+		break;
+	}
+	case SET_CHANNELS_WS2812_INTERLEAVED: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		uint8_t order[4] = {ch->or, ch->og, ch->ob, ch->ow};
+		uint32_t slot[2];
+		uint32_t * dst = parser.dst;
+		drawWait(dst + units * 2*ch->numElements);
+		while (units--) {
+			for (int e = 0; e < ch->numElements; e++) {
+				memcpy(slot, data, sizeof(slot));
+				data += sizeof(slot);
+				//channel outputs are reverse numbered, so the first byte in the slot is the highest bit
+				if (parser.channel < 8)
+					bitTranspose8(dst + 2*order[e], __REV(slot[1]), __REV(slot[0]));
 			}
+			dst += 2*ch->numElements;
+		}
+		parser.dst = dst;
+		break;
+	}
+	case SET_CHANNELS_WS2812_MULTICAST: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		uint8_t elements[4];
+		uint32_t * dst = parser.dst;
+		drawWait(dst + units * 2*ch->numElements);
+		while (units--) {
+			elements[ch->or] = *data++;
+			elements[ch->og] = *data++;
+			elements[ch->ob] = *data++;
+			if (ch->numElements == 4)
+				elements[ch->ow] = *data++;
+			//every selected output in one pass
+			bitConverterMask(dst, parser.outputMask, elements, ch->numElements);
+			dst += 2*ch->numElements;
+		}
+		parser.dst = dst;
+		break;
+	}
+	default:
+		break;
+	}
+}
 
-			uint8_t or = ch.or;
-			uint8_t og = ch.og;
-			uint8_t ob = ch.ob;
+//keeps or throws out ws2812 data that has been written to one channel
+static void ws2812ChannelEnd(uint8_t channel, PBWS2812Channel *ch, int crcOk) {
+	int blocksToZero;
+	if (crcOk) {
+		if (channels[channel].type == SET_CHANNEL_WS2812
+				&& (ch->pixels * ch->numElements >=
+						channels[channel].ws2812Channel.pixels * channels[channel].ws2812Channel.numElements)
+			) {
+			blocksToZero = 0;
+		} else {
+			//we need to zero out previous data if the data received was less than last time
+			blocksToZero = BYTES_PER_CHANNEL - ch->numElements * ch->pixels;
+		}
 
-			uint8_t elements[4] = {0,0,0,0};
-			uint32_t * dst = bitBuffer;
+		channels[channel].type = SET_CHANNEL_WS2812;
+		channels[channel].ws2812Channel = *ch;
 
-			//start frame
-			bitConverter(dst, channel, elements, 4);
-			dst += 8;
+		lastDataMs = ms;
+	} else {
+		//garbage data, disable the channel, zero everything.
+		//its better to let the LEDs keep the previous values than draw garbage.
+		channels[channel].type = SET_CHANNEL_WS2812;
+		memset(&channels[channel].ws2812Channel, 0, sizeof(channels[0].ws2812Channel));
+		blocksToZero = BYTES_PER_CHANNEL;
+	}
+	//zero out any remaining data in the buffer for this channel
+	if (blocksToZero > 0)
+		queueZeros(channel, blocksToZero, 0);
+}
 
-			for (int i = 0; i < ch.pixels; i++) {
-				elements[or+1] = uartGetc();
-				elements[og+1] = uartGetc();
-				elements[ob+1] = uartGetc();
-				elements[0] = uartGetc() | 0xe0;
-				bitConverter(dst, channel, elements, 4);
-				dst += 8;
-			}
+//renders a fill, or a gradient if color2 is set, into every output in mask
+static void ws2812Generate(uint8_t mask, PBWS2812Channel *ch, const uint8_t *color, const uint8_t *color2) {
+	int numElements = ch->numElements;
+	uint8_t order[4] = {ch->or, ch->og, ch->ob, ch->ow};
+	uint8_t elements[4];
+	uint32_t *dst = backBuffer;
+	if (ch->pixels == 0)
+		return;
+	if (!color2) {
+		//one pixel is converted, the rest are copies of its bits
+		for (int e = 0; e < numElements; e++)
+			elements[order[e]] = color[e];
+		drawWait(dst + ch->pixels * 2*numElements);
+		bitConverterMask(dst, mask, elements, numElements);
+		bitReplicate(dst, mask, 2*numElements, ch->pixels - 1);
+		return;
+	}
+	//16.16 fixed point, so the last pixel lands on color2
+	int32_t value[4], step[4];
+	int steps = ch->pixels > 1 ? ch->pixels - 1 : 1;
+	for (int e = 0; e < numElements; e++) {
+		value[e] = (color[e] << 16) + 0x8000;
+		step[e] = (color2[e] - color[e]) * 65536 / steps;
+	}
+	for (int i = 0; i < ch->pixels; i++) {
+		for (int e = 0; e < numElements; e++) {
+			elements[order[e]] = value[e] >> 16;
+			value[e] += step[e];
+		}
+		drawWait(dst + 2*numElements);
+		bitConverterMask(dst, mask, elements, numElements);
+		dst += 2*numElements;
+	}
+}
 
-			//end frame
-			elements[0] = 0xff;
-			elements[1] = elements[2] = elements[3] = 0;
-			bitConverter(dst, channel, elements, 4);
+//called when the record's data runs out, returns the next parser state.
+//records that send their data in more than one part set up the next part here
+static int recordDataDone() {
+	if (parser.recordType == SET_CHANNEL_WS2812_PALETTE && parser.phase == 0) {
+		//indexes come after the palette, a byte at a time
+		parser.phase = 1;
+		parser.unitSize = 1;
+		parser.units = (parser.ws2812Channel.pixels * parser.ws2812PaletteChannel.indexBits + 7) / 8;
+		if (parser.units)
+			return PARSE_DATA;
+	}
+	return recordDone();
+}
 
-			volatile uint32_t crcExpected = uartGetCrc();
-			volatile uint32_t crcRead;
-			uartRead((void *) &crcRead, sizeof(crcRead));
+//output bits the current record writes on this board
+static uint8_t recordOutputs() {
+	switch (parser.recordType) {
+	case SET_CHANNELS_WS2812_INTERLEAVED:
+		return parser.channel < 8 ? 0xff : 0;
+	case SET_CHANNELS_WS2812_MULTICAST:
+	case SET_CHANNELS_WS2812_FILL:
+	case SET_CHANNELS_WS2812_GRADIENT:
+		return parser.outputMask;
+	case DRAW_ALL:
+	case BATCH_RECORDS:
+	case SET_WS2812_TIMING:
+		return 0;
+	default:
+		return parser.channel < 8 ? 1 << parser.channel : 0;
+	}
+}
 
-			ledOff();
-			if (channel < 8) {
-				int blocksToZero;
-				if (crcExpected == crcRead) {
-					if (channels[channel].type == SET_CHANNEL_APA102_DATA
-							&& (ch.pixels >= channels[channel].apa102DataChannel.pixels)
-						) {
-						blocksToZero = 0;
-					} else {
-						//we need to zero out previous data if the data received was less than last time
-						blocksToZero = BYTES_PER_CHANNEL - ch.pixels * 4;
-					}
-
-					channels[channel].type = SET_CHANNEL_APA102_DATA;
-					channels[channel].apa102DataChannel = ch;
-
-					lastDataMs = ms;
+//moves on to the next record in the batch, or to the batch's CRC after the last one
+static int batchNext() {
+	if (--parser.batchLeft)
+		return PARSE_BATCH_RECORD;
+	parser.recordType = BATCH_RECORDS;
+	return PARSE_CRC;
+}
+
+//clears a channel and its data, keeping its type
+static void disableChannel(uint8_t channel) {
+	PBChannel off = { .type = channels[channel].type };
+	channels[channel] = off;
+	queueZeros(channel, BYTES_PER_CHANNEL, 0);
+}
+
+//the record's data is all in. on its own it waits for its CRC. in a batch it's kept for now,
+//and thrown out along with everything else the batch wrote if the batch CRC doesn't match
+static int recordDone() {
+	if (!parser.batchLeft)
+		return PARSE_CRC;
+	recordEnd(1);
+	parser.batchOutputs |= recordOutputs();
+	return batchNext();
+}
+
+//gives up on the rest of a batch
+static void batchAbort() {
+	ledOff();
+	parser.batchLeft = 0;
+	parser.recordType = BATCH_RECORDS;
+	recordEnd(0);
+}
+
+//called once the CRC is in. data has already been written, so this keeps the channel or throws it out
+static void recordEnd(int crcOk) {
+	uint8_t channel = parser.channel;
+	switch (parser.recordType) {
+	case SET_CHANNEL_WS2812:
+		if (channel < 8) {
+			if (!crcOk)
+				countCrcError();
+			ws2812ChannelEnd(channel, &parser.ws2812Channel, crcOk);
+		}
+		break;
+	case SET_CHANNEL_WS2812_PALETTE:
+		if (channel < 8) {
+			//an index past the end of the palette is as bad as a CRC mismatch
+			crcOk = crcOk && !parser.badData;
+			if (!crcOk)
+				countCrcError();
+			ws2812ChannelEnd(channel, &parser.ws2812Channel, crcOk);
+		}
+		break;
+	case SET_CHANNEL_WS2812_RLE:
+		if (channel < 8) {
+			//runs that don't add up to the pixels are as bad as a CRC mismatch
+			crcOk = crcOk && parser.pixelsLeft == 0 && !parser.badData;
+			if (!crcOk)
+				countCrcError();
+			ws2812ChannelEnd(channel, &parser.ws2812Channel, crcOk);
+		}
+		break;
+	case SET_CHANNELS_WS2812_FILL:
+	case SET_CHANNELS_WS2812_GRADIENT:
+		if (parser.outputMask) {
+			if (crcOk) {
+				PBWS2812Channel *ch = &parser.ws2812Channel;
+				for (int c = 0; c < 8; c++) {
+					if (parser.outputMask & (1 << c))
+						skipZeros(c, ch->pixels * ch->numElements, 0);
+				}
+				ws2812Generate(parser.outputMask, ch, parser.ws2812Fill.color,
+						parser.recordType == SET_CHANNELS_WS2812_GRADIENT ? parser.ws2812Gradient.color2 : 0);
+				for (int c = 0; c < 8; c++) {
+					if (parser.outputMask & (1 << c))
+						ws2812ChannelEnd(c, ch, 1);
+				}
+			} else {
+				//nothing has been written yet, so the channels can keep what they had
+				countCrcError();
+			}
+		}
+		break;
+	case SET_CHANNEL_WS2812_DELTA:
+		if (channel < 8) {
+			if (crcOk && !parser.badData && !parser.literalLeft) {
+				lastDataMs = ms;
+			} else {
+				//the delta went in as it arrived, so the channel can't be put back the way it was. throw out all of it
+				countCrcError();
+				ws2812ChannelEnd(channel, &parser.ws2812Channel, 0);
+			}
+		}
+		break;
+	case SET_CHANNEL_WS2812_RANGE:
+		if (channel < 8) {
+			if (crcOk) {
+				lastDataMs = ms;
+			} else {
+				//part of the channel is garbage now, throw out all of it
+				countCrcError();
+				ws2812ChannelEnd(channel, &parser.ws2812Channel, 0);
+			}
+		}
+		break;
+	case SET_CHANNELS_WS2812_MULTICAST:
+		if (parser.outputMask) {
+			if (!crcOk)
+				countCrcError();
+			for (int c = 0; c < 8; c++) {
+				if (parser.outputMask & (1 << c))
+					ws2812ChannelEnd(c, &parser.ws2812Channel, crcOk);
+			}
+		}
+		break;
+	case DRAW_ALL:
+		if (parser.batchLeft) {
+			//not until the whole batch checks out
+			parser.batchFlags |= BATCH_DRAW;
+		} else if (crcOk) {
+			flushZeros();
+			startDrawingChannles();
+		} else {
+			countCrcError();
+		}
+		break;
+	case BATCH_RECORDS:
+		if (crcOk) {
+			if (parser.batchTiming)
+				ws2812Timing = batchTimingPending;
+			if (parser.batchFlags & BATCH_DRAW) {
+				flushZeros();
+				startDrawingChannles();
+			}
+		} else {
+			//everything in the batch was kept as it came in, throw out whatever it touched
+			countCrcError();
+			for (int c = 0; c < 8; c++) {
+				if (parser.batchOutputs & (1 << c))
+					disableChannel(c);
+			}
+		}
+		break;
+	case SET_WS2812_TIMING:
+		if (channel < 8) {
+			if (parser.batchLeft) {
+				//not until the whole batch checks out, the next draw shouldn't go out at a timing that might be garbage
+				ws2812TimingFor(&parser.ws2812Timing, &batchTimingPending);
+				parser.batchTiming = 1;
+			} else if (crcOk) {
+				ws2812TimingFor(&parser.ws2812Timing, &ws2812Timing);
+				lastDataMs = ms;
+			} else {
+				countCrcError();
+			}
+		}
+		break;
+	case SET_CHANNEL_APA102_DATA: {
+		PBAPA102DataChannel *ch = &parser.apa102DataChannel;
+		if (channel < 8) {
+			int blocksToZero;
+			if (crcOk) {
+				if (channels[channel].type == SET_CHANNEL_APA102_DATA
+						&& (ch->pixels >= channels[channel].apa102DataChannel.pixels)
+					) {
+					blocksToZero = 0;
 				} else {
-					//garbage data, disable the channel, zero everything.
-					//its better to let the LEDs keep the previous values than draw garbage.
-					debugStats.crcErrors++;
-					channels[channel].type = SET_CHANNEL_APA102_DATA;
-					memset(&channels[channel].apa102DataChannel, 0, sizeof(channels[0].apa102DataChannel));
-					blocksToZero = BYTES_PER_CHANNEL;
+					//we need to zero out previous data if the data received was less than last time
+					blocksToZero = BYTES_PER_CHANNEL - (ch->pixels+2) * 4;
 				}
-				//zero out any remaining data in the buffer for this channel
-				//TODO FIXME apa102 zeros will cause a start frame, not what we want. set to all ones instead
-				if (blocksToZero > 0)
-					bitSetZeros(bitBuffer + (BYTES_PER_CHANNEL - blocksToZero)*2, channel, blocksToZero);
+
+				channels[channel].type = SET_CHANNEL_APA102_DATA;
+				channels[channel].apa102DataChannel = *ch;
+
+				lastDataMs = ms;
+			} else {
+				//garbage data, disable the channel, zero everything.
+				//its better to let the LEDs keep the previous values than draw garbage.
+				countCrcError();
+				channels[channel].type = SET_CHANNEL_APA102_DATA;
+				memset(&channels[channel].apa102DataChannel, 0, sizeof(channels[0].apa102DataChannel));
+				blocksToZero = BYTES_PER_CHANNEL;
 			}
-			break;
+			//zero out any remaining data in the buffer for this channel, it's in front of the start frame
+			if (blocksToZero > 0)
+				queueZeros(channel, blocksToZero, 1);
 		}
-		case SET_CHANNEL_APA102_CLOCK: {
-			//read in the header
-			PBAPA102ClockChannel ch;
-			uartRead(&ch, sizeof(ch));
-			if (ch.frequency == 0)
-				return;
+		break;
+	}
+	case SET_CHANNEL_APA102_CLOCK: {
+		if (channel < 8) {
+			int blocksToZero;
+			if (crcOk) {
+				if (channels[channel].type == SET_CHANNEL_APA102_CLOCK) {
+					blocksToZero = 0;
+				} else {
+					//we need to zero out previous data
+					blocksToZero = BYTES_PER_CHANNEL;
+				}
+
+				channels[channel].type = SET_CHANNEL_APA102_CLOCK;
+				channels[channel].apa102ClockChannel = parser.apa102ClockChannel;
 
-			//check that it's one of ours
-			//TODO handle broadcast?
-			if (channel >> 3 != getBusId()) {
-				//follow along, but ignore data
-				channel = 0xff;
+				lastDataMs = ms;
 			} else {
-				channel = 7 - (channel & 7); //channel outputs are reverse numbered
-				ledOn();
+				//garbage data, disable the channel, zero everything. Some apa102 channels could be without clock, so should remain unchanged
+				countCrcError();
+				channels[channel].type = SET_CHANNEL_APA102_CLOCK;
+				memset(&channels[channel].apa102ClockChannel, 0, sizeof(channels[0].apa102ClockChannel));
+				blocksToZero = BYTES_PER_CHANNEL;
+			}
+			//zero out any remaining data in the buffer for this channel
+			if (blocksToZero > 0)
+				queueZeros(channel, blocksToZero, 0);
+		}
+		break;
+	}
+	case SET_CHANNELS_WS2812_INTERLEAVED: {
+		PBWS2812Channel *ch = &parser.ws2812Channel;
+		if (channel < 8) {
+			int bytes = ch->pixels * ch->numElements;
+			int bytesToZero = 0;
+			if (crcOk) {
+				//the slots wrote every channel, so any channel that had more data leaves a tail to clear
+				for (int c = 0; c < 8; c++) {
+					if (channels[c].type != SET_CHANNEL_WS2812
+							|| bytes < channels[c].ws2812Channel.pixels * channels[c].ws2812Channel.numElements)
+						bytesToZero = BYTES_PER_CHANNEL - bytes;
+					channels[c].type = SET_CHANNEL_WS2812;
+					channels[c].ws2812Channel = *ch;
+				}
+				lastDataMs = ms;
+			} else {
+				//garbage data, disable all channels, zero everything.
+				countCrcError();
+				for (int c = 0; c < 8; c++) {
+					channels[c].type = SET_CHANNEL_WS2812;
+					memset(&channels[c].ws2812Channel, 0, sizeof(channels[0].ws2812Channel));
+				}
+				bytesToZero = BYTES_PER_CHANNEL;
+			}
+			//every channel is cleared, so whole words can be written. this covers anything queued too
+			if (bytesToZero > 0) {
+				drawWait(backBuffer + BYTES_PER_CHANNEL*2);
+				memset(backBuffer + (BYTES_PER_CHANNEL - bytesToZero)*2, 0, bytesToZero * 8);
+				for (int c = 0; c < 8; c++)
+					zerosPending[c] = 0;
+				zerosAtStart = 0;
 			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
 
-			volatile uint32_t crcExpected = uartGetCrc();
-			volatile uint32_t crcRead;
-			uartRead((void *) &crcRead, sizeof(crcRead));
+#if UART_AUTOBAUD
+#define AUTOBAUD_MAX_BAD_BURSTS 4
+static uint8_t badBursts = AUTOBAUD_MAX_BAD_BURSTS; //start unlocked
+//set when a frame passes its CRC, or a frame header after the magic makes sense even if the frame is for
+//another board and skipped. cleared when the line goes idle
+static uint8_t burstLocked;
+#endif
+
+//the line went idle, a frame that isn't finished by now never will be. drop it and look for the next magic
+static void handleIdle() {
+	parser.timedOut = 1;
+	switch (parser.state) {
+	case PARSE_DATA:
+	case PARSE_CRC:
+		ledOff();
+		//a record cut short in a batch is thrown out with the rest of the batch below
+		if (parser.batchLeft)
+			parser.batchOutputs |= recordOutputs();
+		else
+			recordEnd(0);
+		debugStats.frameTimeouts++;
+		break;
+	case PARSE_FRAME_HEADER:
+	case PARSE_RECORD_HEADER:
+	case PARSE_SKIP:
+	case PARSE_BATCH_RECORD:
+		debugStats.frameTimeouts++;
+		break;
+	default:
+		break;
+	}
+	if (parser.batchLeft)
+		batchAbort();
+	parser.timedOut = 0;
+	parser.state = PARSE_MAGIC;
+	parser.magicPos = 0;
+#if UART_AUTOBAUD
+	//a few bursts in a row without a good frame or frame header means we're at the wrong rate
+	if (burstLocked)
+		badBursts = 0;
+	else if (badBursts < AUTOBAUD_MAX_BAD_BURSTS)
+		badBursts++;
+	burstLocked = 0;
+#endif
+}
 
-			ledOff();
-			if (channel < 8) {
-				int blocksToZero;
-				if (crcExpected == crcRead) {
-					if (channels[channel].type == SET_CHANNEL_APA102_CLOCK) {
-						blocksToZero = 0;
-					} else {
-						//we need to zero out previous data
-						blocksToZero = BYTES_PER_CHANNEL;
-					}
-
-					channels[channel].type = SET_CHANNEL_APA102_CLOCK;
-					channels[channel].apa102ClockChannel = ch;
-
-					lastDataMs = ms;
+// this is the main uart scan function. It ignores data until the magic UPXL string is seen.
+// It handles whatever has arrived and returns when it needs more, picking up where it left off on the next call
+static inline void handleIncomming() {
+	for (;;) {
+		int available = uartAvailable();
+		switch (parser.state) {
+		case PARSE_MAGIC:
+			//look for the 4 byte magic header sequence
+			if (available < 1)
+				return;
+			if (parser.magicPos == 0) {
+				//skip anything that can't start a frame in one go, it doesn't need to go through the CRC
+				uint8_t *p;
+				int span = uartSpan(&p);
+				uint8_t *start = memchr(p, MAGIC[0], span);
+				if (start != p) {
+					uartSkip(start ? start - p : span);
+					debugStats.frameMisses++;
+					break;
+				}
+				uartResetCrc();
+			}
+			if (uartPeek() == MAGIC[parser.magicPos]) {
+				uartGetc();
+				if (++parser.magicPos == 4) {
+					parser.magicPos = 0;
+					parser.state = PARSE_FRAME_HEADER;
+				}
+			} else {
+				//a partial match leaves the byte for another look, it could be the start of the magic
+				if (parser.magicPos == 0)
+					uartGetc();
+				parser.magicPos = 0;
+				debugStats.frameMisses++;
+			}
+			break;
+		case PARSE_FRAME_HEADER:
+			if (available < 2)
+				return;
+			parser.frameChannel = uartGetc();
+			parser.recordType = uartGetc();
+			parser.headerSize = recordHeaderSize(parser.recordType);
+			//unsupported op or garbage frame, just wait for the next one
+			parser.state = parser.headerSize < 0 ? PARSE_MAGIC : PARSE_RECORD_HEADER;
+#if UART_AUTOBAUD
+			//the magic and a record type we know won't come out of a wrong rate, so a shared bus
+			//carrying only other boards' frames doesn't look like lost lock
+			if (parser.headerSize >= 0)
+				burstLocked = 1;
+#endif
+			break;
+		case PARSE_RECORD_HEADER:
+			if (available < parser.headerSize)
+				return;
+			uartRead(&parser.ws2812Channel, parser.headerSize);
+			parser.state = recordBegin();
+			//a bad record leaves the rest of its batch with nowhere to start
+			if (parser.state == PARSE_MAGIC && parser.batchLeft)
+				batchAbort();
+			break;
+		case PARSE_BATCH_RECORD: {
+			PBBatchRecord record;
+			if (available < (int) sizeof(record))
+				return;
+			uartRead(&record, sizeof(record));
+			parser.frameChannel = record.channel;
+			parser.recordType = record.recordType;
+			parser.headerSize = recordHeaderSize(record.recordType);
+			if (parser.headerSize >= 0 && record.recordType != BATCH_RECORDS) {
+				parser.state = PARSE_RECORD_HEADER;
+			} else if (record.length) {
+				//not something that can go in a batch, but the sender said how to get past it
+				parser.skipBytes = record.length;
+				parser.state = PARSE_SKIP;
+			} else {
+				batchAbort();
+				parser.state = PARSE_MAGIC;
+			}
+			break;
+		}
+		case PARSE_DATA: {
+			//convert straight out of the uart buffer, as many whole units as it has in one piece
+			uint8_t *p;
+			int units = uartSpan(&p) / parser.unitSize;
+			if (units > parser.units)
+				units = parser.units;
+			if (units) {
+				recordData(p, units);
+				uartCommit(units * parser.unitSize);
+			} else if (available >= parser.unitSize) {
+				//this unit wraps around the end of the buffer
+				uint8_t unit[32];
+				uartRead(unit, parser.unitSize);
+				recordData(unit, 1);
+				units = 1;
+			} else {
+				return;
+			}
+			parser.units -= units;
+			if (parser.units == 0)
+				parser.state = recordDataDone();
+			break;
+		}
+		case PARSE_SKIP: {
+			if (parser.skipBytes) {
+				int skip = available < parser.skipBytes ? available : parser.skipBytes;
+				if (skip == 0)
+					return;
+				if (parser.batchLeft) {
+					//the batch CRC covers records for other boards too
+					uint8_t *p;
+					int span = uartSpan(&p);
+					if (skip > span)
+						skip = span;
+					uartCommit(skip);
 				} else {
-					//garbage data, disable the channel, zero everything. Some apa102 channels could be without clock, so should remain unchanged
-					debugStats.crcErrors++;
-					channels[channel].type = SET_CHANNEL_APA102_CLOCK;
-					memset(&channels[channel].apa102ClockChannel, 0, sizeof(channels[0].apa102ClockChannel));
-					blocksToZero = BYTES_PER_CHANNEL;
+					uartSkip(skip);
 				}
-				//zero out any remaining data in the buffer for this channel
-				if (blocksToZero > 0)
-					bitSetZeros(bitBuffer + (BYTES_PER_CHANNEL - blocksToZero)*2, channel, blocksToZero);
+				parser.skipBytes -= skip;
 			}
+			if (parser.skipBytes == 0)
+				parser.state = parser.batchLeft ? batchNext() : PARSE_MAGIC;
 			break;
 		}
-		default:
+		case PARSE_CRC: {
+			if (available < 4)
+				return;
+			uint32_t crcExpected = uartGetCrc();
+			uint32_t crcRead;
+			uartRead(&crcRead, sizeof(crcRead));
+			ledOff();
+			recordEnd(crcExpected == crcRead);
+#if UART_AUTOBAUD
+			if (crcExpected == crcRead)
+				burstLocked = 1;
+#endif
+			parser.state = PARSE_MAGIC;
 			break;
-			//unsupported op or garbage frame, just wait for the next one
 		}
-
-	} else {
-		debugStats.frameMisses++;
+		}
 	}
 }
+
 void loop() {
 	for (;;) {
+#if UART_AUTOBAUD
+		if (badBursts >= AUTOBAUD_MAX_BAD_BURSTS) {
+			int autobaud = uartAutobaud();
+			//whatever was parsed so far was at the old rate, drop it like the line went idle
+			if (autobaud == 1)
+				handleIdle();
+			if (autobaud)
+				badBursts = 0;
+		}
+#endif
+		//checked first, so the parser has seen everything up to the mark before it's dropped
+		int idle = uartIdlePending();
 		if (uartAvailable() > 0) {
 			handleIncomming();
+		} else if (!idle) {
+			//caught up, use the gap for background work
+			runZeros(64, 0);
+		}
+		if (idle) {
+			uartSkipToIdle();
+			handleIdle();
 		}
 	}
 }
@@ -38,6 +38,36 @@ union b32 {
 };
 
 
+//cortex-m3 maps every bit in sram to its own word in the bit-band alias region.
+//a store there sets or clears a single bit without a read-modify-write in code.
+//consecutive bytes of the buffer are 8 alias words apart
+#define BITBAND_SRAM(addr, bit) ((volatile uint32_t *) (SRAM_BB_BASE + (((uint32_t) (addr) - SRAM_BASE) << 5) + ((bit) << 2)))
+
+#if BIT_CONVERTER == BIT_CONVERTER_BITBAND
+static inline void bitBandFill(uint32_t *dst, uint8_t channel, int numBlocks, uint32_t value) {
+	volatile uint32_t *bb = BITBAND_SRAM(dst, channel);
+	volatile uint32_t *end = bb + numBlocks * 64;
+	while (bb < end) {
+		bb[0] = value;
+		bb[8] = value;
+		bb[16] = value;
+		bb[24] = value;
+		bb[32] = value;
+		bb[40] = value;
+		bb[48] = value;
+		bb[56] = value;
+		bb += 64;
+	}
+}
+
+void bitSetZeros(uint32_t *dst, uint8_t channel, int numBlocks) {
+	bitBandFill(dst, channel, numBlocks, 0);
+}
+
+void bitSetOnes(uint32_t *dst, uint8_t channel, int numBlocks) {
+	bitBandFill(dst, channel, numBlocks, 1);
+}
+#else
 //assumes 8 byte blocks, size in 8 byte blocks
 void bitSetZeros(uint32_t *dst, uint8_t channel, int numBlocks) {
 	uint32_t *o0 = dst;
@@ -59,6 +89,21 @@ void bitSetOnes(uint32_t *dst, uint8_t channel, int numBlocks) {
 		*o1++ |= mask;
 	}
 }
+#endif
+
+//copies the first words of dst, for the output bits in mask only, into the copies that follow it.
+//used to repeat a pixel that has already been converted without converting it again
+void bitReplicate(uint32_t *dst, uint8_t mask, int words, int copies) {
+	const uint32_t keep = ~(0x01010101 * mask);
+	const uint32_t *src = dst;
+	uint32_t *o = dst + words;
+	int n = words * copies;
+	//src trails o by one pixel, so it reads copies that were just made
+	while (n--) {
+		*o = (*o & keep) | (*src++ & ~keep);
+		o++;
+	}
+}
 
 template<uint8_t C>
 void bitConverterT(register uint32_t *dst, register uint8_t *data, register int size) {
@@ -161,41 +206,352 @@ void bitConverterT(register uint32_t *dst, register uint8_t *data, register int
 		NOPHACK;
 	}
 }
+//spreads a nibble into bit 0 of each byte lane, msb in the lowest lane to match the buffer's bit order.
+//the 4 shifted copies can't overlap, so the multiply is just a cheap way to shift and or them together
+static inline uint32_t bitSpread4(uint32_t nibble) {
+	return ((nibble * 0x08040201) >> 3) & 0x01010101;
+}
+
+#if BIT_CONVERTER == BIT_CONVERTER_LUT
+//bitSpread4 precomputed for both nibbles of every byte. lives in flash, there's no ram to spare
+static const uint32_t bitSpreadLut[256][2] = {
+		{ 0x00000000, 0x00000000 }, { 0x00000000, 0x01000000 },
+		{ 0x00000000, 0x00010000 }, { 0x00000000, 0x01010000 },
+		{ 0x00000000, 0x00000100 }, { 0x00000000, 0x01000100 },
+		{ 0x00000000, 0x00010100 }, { 0x00000000, 0x01010100 },
+		{ 0x00000000, 0x00000001 }, { 0x00000000, 0x01000001 },
+		{ 0x00000000, 0x00010001 }, { 0x00000000, 0x01010001 },
+		{ 0x00000000, 0x00000101 }, { 0x00000000, 0x01000101 },
+		{ 0x00000000, 0x00010101 }, { 0x00000000, 0x01010101 },
+		{ 0x01000000, 0x00000000 }, { 0x01000000, 0x01000000 },
+		{ 0x01000000, 0x00010000 }, { 0x01000000, 0x01010000 },
+		{ 0x01000000, 0x00000100 }, { 0x01000000, 0x01000100 },
+		{ 0x01000000, 0x00010100 }, { 0x01000000, 0x01010100 },
+		{ 0x01000000, 0x00000001 }, { 0x01000000, 0x01000001 },
+		{ 0x01000000, 0x00010001 }, { 0x01000000, 0x01010001 },
+		{ 0x01000000, 0x00000101 }, { 0x01000000, 0x01000101 },
+		{ 0x01000000, 0x00010101 }, { 0x01000000, 0x01010101 },
+		{ 0x00010000, 0x00000000 }, { 0x00010000, 0x01000000 },
+		{ 0x00010000, 0x00010000 }, { 0x00010000, 0x01010000 },
+		{ 0x00010000, 0x00000100 }, { 0x00010000, 0x01000100 },
+		{ 0x00010000, 0x00010100 }, { 0x00010000, 0x01010100 },
+		{ 0x00010000, 0x00000001 }, { 0x00010000, 0x01000001 },
+		{ 0x00010000, 0x00010001 }, { 0x00010000, 0x01010001 },
+		{ 0x00010000, 0x00000101 }, { 0x00010000, 0x01000101 },
+		{ 0x00010000, 0x00010101 }, { 0x00010000, 0x01010101 },
+		{ 0x01010000, 0x00000000 }, { 0x01010000, 0x01000000 },
+		{ 0x01010000, 0x00010000 }, { 0x01010000, 0x01010000 },
+		{ 0x01010000, 0x00000100 }, { 0x01010000, 0x01000100 },
+		{ 0x01010000, 0x00010100 }, { 0x01010000, 0x01010100 },
+		{ 0x01010000, 0x00000001 }, { 0x01010000, 0x01000001 },
+		{ 0x01010000, 0x00010001 }, { 0x01010000, 0x01010001 },
+		{ 0x01010000, 0x00000101 }, { 0x01010000, 0x01000101 },
+		{ 0x01010000, 0x00010101 }, { 0x01010000, 0x01010101 },
+		{ 0x00000100, 0x00000000 }, { 0x00000100, 0x01000000 },
+		{ 0x00000100, 0x00010000 }, { 0x00000100, 0x01010000 },
+		{ 0x00000100, 0x00000100 }, { 0x00000100, 0x01000100 },
+		{ 0x00000100, 0x00010100 }, { 0x00000100, 0x01010100 },
+		{ 0x00000100, 0x00000001 }, { 0x00000100, 0x01000001 },
+		{ 0x00000100, 0x00010001 }, { 0x00000100, 0x01010001 },
+		{ 0x00000100, 0x00000101 }, { 0x00000100, 0x01000101 },
+		{ 0x00000100, 0x00010101 }, { 0x00000100, 0x01010101 },
+		{ 0x01000100, 0x00000000 }, { 0x01000100, 0x01000000 },
+		{ 0x01000100, 0x00010000 }, { 0x01000100, 0x01010000 },
+		{ 0x01000100, 0x00000100 }, { 0x01000100, 0x01000100 },
+		{ 0x01000100, 0x00010100 }, { 0x01000100, 0x01010100 },
+		{ 0x01000100, 0x00000001 }, { 0x01000100, 0x01000001 },
+		{ 0x01000100, 0x00010001 }, { 0x01000100, 0x01010001 },
+		{ 0x01000100, 0x00000101 }, { 0x01000100, 0x01000101 },
+		{ 0x01000100, 0x00010101 }, { 0x01000100, 0x01010101 },
+		{ 0x00010100, 0x00000000 }, { 0x00010100, 0x01000000 },
+		{ 0x00010100, 0x00010000 }, { 0x00010100, 0x01010000 },
+		{ 0x00010100, 0x00000100 }, { 0x00010100, 0x01000100 },
+		{ 0x00010100, 0x00010100 }, { 0x00010100, 0x01010100 },
+		{ 0x00010100, 0x00000001 }, { 0x00010100, 0x01000001 },
+		{ 0x00010100, 0x00010001 }, { 0x00010100, 0x01010001 },
+		{ 0x00010100, 0x00000101 }, { 0x00010100, 0x01000101 },
+		{ 0x00010100, 0x00010101 }, { 0x00010100, 0x01010101 },
+		{ 0x01010100, 0x00000000 }, { 0x01010100, 0x01000000 },
+		{ 0x01010100, 0x00010000 }, { 0x01010100, 0x01010000 },
+		{ 0x01010100, 0x00000100 }, { 0x01010100, 0x01000100 },
+		{ 0x01010100, 0x00010100 }, { 0x01010100, 0x01010100 },
+		{ 0x01010100, 0x00000001 }, { 0x01010100, 0x01000001 },
+		{ 0x01010100, 0x00010001 }, { 0x01010100, 0x01010001 },
+		{ 0x01010100, 0x00000101 }, { 0x01010100, 0x01000101 },
+		{ 0x01010100, 0x00010101 }, { 0x01010100, 0x01010101 },
+		{ 0x00000001, 0x00000000 }, { 0x00000001, 0x01000000 },
+		{ 0x00000001, 0x00010000 }, { 0x00000001, 0x01010000 },
+		{ 0x00000001, 0x00000100 }, { 0x00000001, 0x01000100 },
+		{ 0x00000001, 0x00010100 }, { 0x00000001, 0x01010100 },
+		{ 0x00000001, 0x00000001 }, { 0x00000001, 0x01000001 },
+		{ 0x00000001, 0x00010001 }, { 0x00000001, 0x01010001 },
+		{ 0x00000001, 0x00000101 }, { 0x00000001, 0x01000101 },
+		{ 0x00000001, 0x00010101 }, { 0x00000001, 0x01010101 },
+		{ 0x01000001, 0x00000000 }, { 0x01000001, 0x01000000 },
+		{ 0x01000001, 0x00010000 }, { 0x01000001, 0x01010000 },
+		{ 0x01000001, 0x00000100 }, { 0x01000001, 0x01000100 },
+		{ 0x01000001, 0x00010100 }, { 0x01000001, 0x01010100 },
+		{ 0x01000001, 0x00000001 }, { 0x01000001, 0x01000001 },
+		{ 0x01000001, 0x00010001 }, { 0x01000001, 0x01010001 },
+		{ 0x01000001, 0x00000101 }, { 0x01000001, 0x01000101 },
+		{ 0x01000001, 0x00010101 }, { 0x01000001, 0x01010101 },
+		{ 0x00010001, 0x00000000 }, { 0x00010001, 0x01000000 },
+		{ 0x00010001, 0x00010000 }, { 0x00010001, 0x01010000 },
+		{ 0x00010001, 0x00000100 }, { 0x00010001, 0x01000100 },
+		{ 0x00010001, 0x00010100 }, { 0x00010001, 0x01010100 },
+		{ 0x00010001, 0x00000001 }, { 0x00010001, 0x01000001 },
+		{ 0x00010001, 0x00010001 }, { 0x00010001, 0x01010001 },
+		{ 0x00010001, 0x00000101 }, { 0x00010001, 0x01000101 },
+		{ 0x00010001, 0x00010101 }, { 0x00010001, 0x01010101 },
+		{ 0x01010001, 0x00000000 }, { 0x01010001, 0x01000000 },
+		{ 0x01010001, 0x00010000 }, { 0x01010001, 0x01010000 },
+		{ 0x01010001, 0x00000100 }, { 0x01010001, 0x01000100 },
+		{ 0x01010001, 0x00010100 }, { 0x01010001, 0x01010100 },
+		{ 0x01010001, 0x00000001 }, { 0x01010001, 0x01000001 },
+		{ 0x01010001, 0x00010001 }, { 0x01010001, 0x01010001 },
+		{ 0x01010001, 0x00000101 }, { 0x01010001, 0x01000101 },
+		{ 0x01010001, 0x00010101 }, { 0x01010001, 0x01010101 },
+		{ 0x00000101, 0x00000000 }, { 0x00000101, 0x01000000 },
+		{ 0x00000101, 0x00010000 }, { 0x00000101, 0x01010000 },
+		{ 0x00000101, 0x00000100 }, { 0x00000101, 0x01000100 },
+		{ 0x00000101, 0x00010100 }, { 0x00000101, 0x01010100 },
+		{ 0x00000101, 0x00000001 }, { 0x00000101, 0x01000001 },
+		{ 0x00000101, 0x00010001 }, { 0x00000101, 0x01010001 },
+		{ 0x00000101, 0x00000101 }, { 0x00000101, 0x01000101 },
+		{ 0x00000101, 0x00010101 }, { 0x00000101, 0x01010101 },
+		{ 0x01000101, 0x00000000 }, { 0x01000101, 0x01000000 },
+		{ 0x01000101, 0x00010000 }, { 0x01000101, 0x01010000 },
+		{ 0x01000101, 0x00000100 }, { 0x01000101, 0x01000100 },
+		{ 0x01000101, 0x00010100 }, { 0x01000101, 0x01010100 },
+		{ 0x01000101, 0x00000001 }, { 0x01000101, 0x01000001 },
+		{ 0x01000101, 0x00010001 }, { 0x01000101, 0x01010001 },
+		{ 0x01000101, 0x00000101 }, { 0x01000101, 0x01000101 },
+		{ 0x01000101, 0x00010101 }, { 0x01000101, 0x01010101 },
+		{ 0x00010101, 0x00000000 }, { 0x00010101, 0x01000000 },
+		{ 0x00010101, 0x00010000 }, { 0x00010101, 0x01010000 },
+		{ 0x00010101, 0x00000100 }, { 0x00010101, 0x01000100 },
+		{ 0x00010101, 0x00010100 }, { 0x00010101, 0x01010100 },
+		{ 0x00010101, 0x00000001 }, { 0x00010101, 0x01000001 },
+		{ 0x00010101, 0x00010001 }, { 0x00010101, 0x01010001 },
+		{ 0x00010101, 0x00000101 }, { 0x00010101, 0x01000101 },
+		{ 0x00010101, 0x00010101 }, { 0x00010101, 0x01010101 },
+		{ 0x01010101, 0x00000000 }, { 0x01010101, 0x01000000 },
+		{ 0x01010101, 0x00010000 }, { 0x01010101, 0x01010000 },
+		{ 0x01010101, 0x00000100 }, { 0x01010101, 0x01000100 },
+		{ 0x01010101, 0x00010100 }, { 0x01010101, 0x01010100 },
+		{ 0x01010101, 0x00000001 }, { 0x01010101, 0x01000001 },
+		{ 0x01010101, 0x00010001 }, { 0x01010101, 0x01010001 },
+		{ 0x01010101, 0x00000101 }, { 0x01010101, 0x01000101 },
+		{ 0x01010101, 0x00010101 }, { 0x01010101, 0x01010101 } };
+
+static inline uint32_t bitSpreadHi(uint8_t in) {
+	return bitSpreadLut[in][0];
+}
+static inline uint32_t bitSpreadLo(uint8_t in) {
+	return bitSpreadLut[in][1];
+}
+#else
+static inline uint32_t bitSpreadHi(uint8_t in) {
+	return bitSpread4(in >> 4);
+}
+static inline uint32_t bitSpreadLo(uint8_t in) {
+	return bitSpread4(in & 0xf);
+}
+#endif
+
+//same output as bitConverterT, but each byte costs 2 word RMWs instead of 16 bitfield RMWs
+template<uint8_t C>
+void bitConverterWordT(uint32_t *dst, uint8_t *data, int size) {
+	const uint32_t mask = bitMasks[C];
+	while (size--) {
+		uint8_t in = *data++;
+		dst[0] = (dst[0] & mask) | (bitSpreadHi(in) << C);
+		dst[1] = (dst[1] & mask) | (bitSpreadLo(in) << C);
+		dst += 2;
+	}
+}
+
+//writes each bit through its bit-band alias, 8 single stores per byte
+template<uint8_t C>
+void bitConverterBitbandT(uint32_t *dst, uint8_t *data, int size) {
+	volatile uint32_t *bb = BITBAND_SRAM(dst, C);
+	while (size--) {
+		uint8_t in = *data++;
+		//only bit 0 of the stored value is used
+		bb[0] = in >> 7;
+		bb[8] = in >> 6;
+		bb[16] = in >> 5;
+		bb[24] = in >> 4;
+		bb[32] = in >> 3;
+		bb[40] = in >> 2;
+		bb[48] = in >> 1;
+		bb[56] = in;
+		bb += 64;
+	}
+}
+
+#if BIT_CONVERTER != BIT_CONVERTER_BITFIELD
+//converts one byte for a channel known only at runtime. with these engines that is just a register shift
+//or a different alias address, so unlike bitConverterT, nothing needs to switch on the channel
+static inline void bitPut(uint32_t *dst, uint8_t in, uint8_t channel) {
+#if BIT_CONVERTER == BIT_CONVERTER_BITBAND
+	volatile uint32_t *bb = BITBAND_SRAM(dst, channel);
+	bb[0] = in >> 7;
+	bb[8] = in >> 6;
+	bb[16] = in >> 5;
+	bb[24] = in >> 4;
+	bb[32] = in >> 3;
+	bb[40] = in >> 2;
+	bb[48] = in >> 1;
+	bb[56] = in;
+#else
+	const uint32_t mask = bitMasks[channel];
+	dst[0] = (dst[0] & mask) | (bitSpreadHi(in) << channel);
+	dst[1] = (dst[1] & mask) | (bitSpreadLo(in) << channel);
+#endif
+}
+
+//converts pixels with the color order baked in, so each pixel is a straight
+//read, swizzle and convert without a stack array or a call per pixel
+template<int N, int R, int G, int B, int W>
+void pixelConverterT(uint32_t *dst, uint8_t channel, const uint8_t *data, int pixels) {
+	while (pixels--) {
+		bitPut(dst + 2*R, data[0], channel);
+		bitPut(dst + 2*G, data[1], channel);
+		bitPut(dst + 2*B, data[2], channel);
+		if (N == 4)
+			bitPut(dst + 2*W, data[3], channel);
+		data += N;
+		dst += 2*N;
+	}
+}
+
+struct PixelConverterEntry {
+	uint8_t numElements;
+	uint8_t order; //same packing as the color order bits in the channel header
+	PixelConverter convert;
+};
+
+#define PIXEL_CONVERTER3(R, G, B) {3, R | G << 2 | B << 4, pixelConverterT<3, R, G, B, 0>}
+#define PIXEL_CONVERTER4(R, G, B, W) {4, R | G << 2 | B << 4 | W << 6, pixelConverterT<4, R, G, B, W>}
+
+//every valid color order. orders with repeated indexes fall back to the generic path
+static constexpr PixelConverterEntry pixelConverters[] = {
+		PIXEL_CONVERTER3(0, 1, 2), PIXEL_CONVERTER3(0, 2, 1), PIXEL_CONVERTER3(1, 0, 2),
+		PIXEL_CONVERTER3(1, 2, 0), PIXEL_CONVERTER3(2, 0, 1), PIXEL_CONVERTER3(2, 1, 0),
+
+		PIXEL_CONVERTER4(0, 1, 2, 3), PIXEL_CONVERTER4(0, 1, 3, 2), PIXEL_CONVERTER4(0, 2, 1, 3),
+		PIXEL_CONVERTER4(0, 2, 3, 1), PIXEL_CONVERTER4(0, 3, 1, 2), PIXEL_CONVERTER4(0, 3, 2, 1),
+		PIXEL_CONVERTER4(1, 0, 2, 3), PIXEL_CONVERTER4(1, 0, 3, 2), PIXEL_CONVERTER4(1, 2, 0, 3),
+		PIXEL_CONVERTER4(1, 2, 3, 0), PIXEL_CONVERTER4(1, 3, 0, 2), PIXEL_CONVERTER4(1, 3, 2, 0),
+		PIXEL_CONVERTER4(2, 0, 1, 3), PIXEL_CONVERTER4(2, 0, 3, 1), PIXEL_CONVERTER4(2, 1, 0, 3),
+		PIXEL_CONVERTER4(2, 1, 3, 0), PIXEL_CONVERTER4(2, 3, 0, 1), PIXEL_CONVERTER4(2, 3, 1, 0),
+		PIXEL_CONVERTER4(3, 0, 1, 2), PIXEL_CONVERTER4(3, 0, 2, 1), PIXEL_CONVERTER4(3, 1, 0, 2),
+		PIXEL_CONVERTER4(3, 1, 2, 0), PIXEL_CONVERTER4(3, 2, 0, 1), PIXEL_CONVERTER4(3, 2, 1, 0)
+};
+#endif
+
+#if BIT_CONVERTER == BIT_CONVERTER_WORD || BIT_CONVERTER == BIT_CONVERTER_LUT
+#define bitConverterImpl bitConverterWordT
+#elif BIT_CONVERTER == BIT_CONVERTER_BITBAND
+#define bitConverterImpl bitConverterBitbandT
+#else
+#define bitConverterImpl bitConverterT
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//transposes an 8x8 tile, one byte from each of the 8 channels, into a whole 8 byte block.
+//lo holds channels 0-3 and hi holds 4-7, lowest channel in the lowest byte.
+//every channel is written, so there is no need to read the block first
+void bitTranspose8(uint32_t *dst, uint32_t lo, uint32_t hi) {
+	uint32_t t;
+	//swap 1x1, 2x2, then 4x4 blocks
+	t = (lo ^ (lo >> 7)) & 0x00aa00aa;
+	lo ^= t ^ (t << 7);
+	t = (hi ^ (hi >> 7)) & 0x00aa00aa;
+	hi ^= t ^ (t << 7);
+	t = (lo ^ (lo >> 14)) & 0x0000cccc;
+	lo ^= t ^ (t << 14);
+	t = (hi ^ (hi >> 14)) & 0x0000cccc;
+	hi ^= t ^ (t << 14);
+	t = (lo ^ (hi << 4)) & 0xf0f0f0f0;
+	lo ^= t;
+	hi ^= t >> 4;
+	//each byte now holds one bit position of every channel, bit 0 in the lowest byte of lo. buffer is msb first
+	dst[0] = __REV(hi);
+	dst[1] = __REV(lo);
+}
+
+//writes each byte to every output bit set in mask at once. the spread bits are 0 or 1 per byte lane,
+//so multiplying by the mask copies them to all of its bits without carrying into the next lane
+void bitConverterMask(uint32_t *dst, uint8_t mask, const uint8_t *data, int size) {
+	const uint32_t keep = ~(0x01010101 * mask);
+	while (size--) {
+		uint8_t in = *data++;
+		dst[0] = (dst[0] & keep) | (bitSpreadHi(in) * mask);
+		dst[1] = (dst[1] & keep) | (bitSpreadLo(in) * mask);
+		dst += 2;
+	}
+}
+
+//xors each byte into one channel's bits instead of replacing them
+void bitXorConverter(uint32_t *dst, uint8_t channel, const uint8_t *data, int size) {
+	while (size--) {
+		uint8_t in = *data++;
+		dst[0] ^= bitSpreadHi(in) << channel;
+		dst[1] ^= bitSpreadLo(in) << channel;
+		dst += 2;
+	}
+}
+
 void bitConverter(uint32_t *dst, uint8_t dstBit, uint8_t *data, int size) {
 	switch (dstBit) {
 	case 0:
-		bitConverterT<0>(dst, data, size);
+		bitConverterImpl<0>(dst, data, size);
 		break;
 	case 1:
-		bitConverterT<1>(dst, data, size);
+		bitConverterImpl<1>(dst, data, size);
 		break;
 	case 2:
-		bitConverterT<2>(dst, data, size);
+		bitConverterImpl<2>(dst, data, size);
 		break;
 	case 3:
-		bitConverterT<3>(dst, data, size);
+		bitConverterImpl<3>(dst, data, size);
 		break;
 	case 4:
-		bitConverterT<4>(dst, data, size);
+		bitConverterImpl<4>(dst, data, size);
 		break;
 	case 5:
-		bitConverterT<5>(dst, data, size);
+		bitConverterImpl<5>(dst, data, size);
 		break;
 	case 6:
-		bitConverterT<6>(dst, data, size);
+		bitConverterImpl<6>(dst, data, size);
 		break;
 	case 7:
-		bitConverterT<7>(dst, data, size);
+		bitConverterImpl<7>(dst, data, size);
 		break;
 	default:
 		break;
 	}
 }
 
+//picks the specialized pixel converter for a record, or 0 if the generic path has to be used
+PixelConverter pixelConverterFor(uint8_t numElements, uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+#if BIT_CONVERTER != BIT_CONVERTER_BITFIELD
+	uint8_t order = r | g << 2 | b << 4;
+	if (numElements == 4)
+		order |= w << 6;
+	for (const PixelConverterEntry &e : pixelConverters) {
+		if (e.numElements == numElements && e.order == order)
+			return e.convert;
+	}
+#endif
+	return 0;
+}
+
 #ifdef __cplusplus
 }
 #endif
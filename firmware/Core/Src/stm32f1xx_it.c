@@ -57,6 +57,7 @@ extern volatile unsigned long ms;
 extern void drawingComplete();
 extern volatile uint32_t microsOverflow;
 extern void uartIsr();
+extern void uartDmaIsr();
 
 /* USER CODE END 0 */
 
@@ -247,8 +248,8 @@ void DMA1_Channel5_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Channel5_IRQn 0 */
 
-	if (DMA1->ISR & DMA_ISR_TCIF5) {
-		DMA1->IFCR |= DMA_ISR_TCIF5;
+	if (DMA1->ISR & (DMA_ISR_HTIF5 | DMA_ISR_TCIF5)) {
+		uartDmaIsr();
 	} else {
 		HardFault_Handler();
 	}
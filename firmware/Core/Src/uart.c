@@ -1,63 +1,80 @@
 #include "main.h"
 #include "app.h"
+#include "crc32.h"
+#include <string.h>
 
 uint8_t uartBuffer[UART_BUF_SIZE];
 int uartPos = 0;
 unsigned long uartErrors;
 
+//bytes consumed since boot, uartPos is this modulo the buffer size
+static uint32_t uartConsumed;
+//times dma has wrapped around the buffer, bytes written since boot is this times the buffer size plus the dma position
+static volatile uint32_t uartWraps;
 
-typedef uint_fast32_t crc_t;
-
-static const crc_t crc_table[256] = { 0x00000000, 0x77073096, 0xee0e612c,
-		0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3, 0x0edb8832,
-		0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07,
-		0x90bf1d91, 0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d,
-		0x6ddde4eb, 0xf4d4b551, 0x83d385c7, 0x136c9856, 0x646ba8c0, 0xfd62f97a,
-		0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5, 0x3b6e20c8,
-		0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd,
-		0xa50ab56b, 0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3,
-		0x45df5c75, 0xdcd60dcf, 0xabd13d59, 0x26d930ac, 0x51de003a, 0xc8d75180,
-		0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f, 0x2802b89e,
-		0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab,
-		0xb6662d3d, 0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589,
-		0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433, 0x7807c9a2, 0x0f00f934, 0x9609a88e,
-		0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01, 0x6b6b51f4,
-		0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1,
-		0xf50fc457, 0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf,
-		0x15da2d49, 0x8cd37cf3, 0xfbd44c65, 0x4db26158, 0x3ab551ce, 0xa3bc0074,
-		0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a,
-		0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f,
-		0xdd0d7cc9, 0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525,
-		0x206f85b3, 0xb966d409, 0xce61e49f, 0x5edef90e, 0x29d9c998, 0xb0d09822,
-		0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad, 0xedb88320,
-		0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615,
-		0x73dc1683, 0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b,
-		0x9309ff9d, 0x0a00ae27, 0x7d079eb1, 0xf00f9344, 0x8708a3d2, 0x1e01f268,
-		0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7, 0xfed41b76,
-		0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43,
-		0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1,
-		0xa6bc5767, 0x3fb506dd, 0x48b2364b, 0xd80d2bda, 0xaf0a1b4c, 0x36034af6,
-		0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79, 0xcb61b38c,
-		0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9,
-		0x5505262f, 0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7,
-		0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d, 0x9b64c2b0, 0xec63f226, 0x756aa39c,
-		0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713, 0x95bf4a82,
-		0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7,
-		0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd,
-		0xf6b9265b, 0x6fb077e1, 0x18b74777, 0x88085ae6, 0xff0f6a70, 0x66063bca,
-		0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45, 0xa00ae278,
-		0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d,
-		0x3e6e77db, 0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53,
-		0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9, 0xbdbdf21c, 0xcabac28a, 0x53b39330,
-		0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf, 0xb3667a2e,
-		0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b,
-		0x2d02ef8d };
+//ring stats for debugging, high water is the most that was ever waiting at a half transfer
+volatile struct {
+	uint16_t overruns;
+	uint16_t highWater;
+} uartStats;
+static uint8_t uartLapped; //set from the overrun until the consumer is back within a buffer of dma
 
+//byte counts where the line went idle, oldest first. a frame never spans one of these
+#define UART_IDLE_MARKS 4
+static volatile uint32_t idleMarks[UART_IDLE_MARKS];
+static volatile uint8_t idleHead;
+static uint8_t idleTail;
+
+
+#if CRC_ENGINE == CRC_ENGINE_HW
+//the crc unit is msb first and only takes whole words. bit reversing each word going in and the result coming out
+//gives the same CRC as the reflected table. bytes that don't make up a whole word yet wait in crcTail
+static uint32_t crcTail;
+static int crcTailBytes;
+
+void crc_update8(uint8_t d) {
+	crcTail |= (uint32_t) d << (crcTailBytes * 8);
+	if (++crcTailBytes == 4) {
+		CRC->DR = __RBIT(crcTail);
+		crcTail = 0;
+		crcTailBytes = 0;
+	}
+}
+
+static inline void crc_update(const uint8_t *data, int size) {
+	while (crcTailBytes && size) {
+		crc_update8(*data++);
+		size--;
+	}
+	while (size >= 4) {
+		uint32_t word;
+		memcpy(&word, data, 4);
+		CRC->DR = __RBIT(word);
+		data += 4;
+		size -= 4;
+	}
+	while (size--)
+		crc_update8(*data++);
+}
+#else
 crc_t crc;
 void crc_update8(uint8_t d) {
-	unsigned int tbl_idx;
-	tbl_idx = (crc ^ d) & 0xff;
-	crc = (crc_table[tbl_idx] ^ (crc >> 8)) & 0xffffffff;
+	crc = crc32Byte(crc, d);
+}
+
+static inline void crc_update(const uint8_t *data, int size) {
+	crc = crc32Update(crc, data, size);
+}
+#endif
+
+//bytes written by dma since boot. called with the uart and dma interrupts held off, so a wrap that
+//just happened may not be counted yet. a pending wrap leaves the position near the start of the buffer
+static inline uint32_t uartHead() {
+	uint32_t pos = UART_BUF_SIZE - DMA1_Channel5->CNDTR;
+	uint32_t wraps = uartWraps;
+	if ((DMA1->ISR & DMA_ISR_TCIF5) && pos < UART_BUF_SIZE / 2)
+		wraps++;
+	return wraps * UART_BUF_SIZE + pos % UART_BUF_SIZE;
 }
 
 void uartSetup() {
@@ -66,23 +83,146 @@ void uartSetup() {
 	DMA1_Channel5->CMAR = (uint32_t) uartBuffer;
 	DMA1_Channel5->CPAR = LL_USART_DMA_GetRegAddr(USART1); //(uint32_t) &USART1->RDR;
 	DMA1_Channel5->CNDTR = UART_BUF_SIZE;
-	DMA1_Channel5->CCR |= DMA_CCR_EN | DMA_CCR_CIRC;
+	//half and full transfer interrupts keep track of how far behind the parser is
+	DMA1_Channel5->CCR |= DMA_CCR_EN | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE;
+
+#if CRC_ENGINE == CRC_ENGINE_HW
+	LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_CRC);
+#endif
 
 	LL_USART_EnableDMAReq_RX(USART1);
 
+#if UART_AUTOBAUD
+	//autobaud times edges with the cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
 	//listen for errors via interrupt
 //	SET_BIT(USART1->CR3, USART_CR3_EIE);
 	LL_USART_EnableIT_ERROR(USART1);
+#if UART_IDLE_ABORT
+	//and for the line going idle, which marks the end of a frame
+	LL_USART_EnableIT_IDLE(USART1);
+#endif
 }
 
+#if UART_AUTOBAUD
+//rates autobaud will snap to, the usart tops out at 4Mbps with a 64MHz APB2
+static const uint32_t autobaudRates[] = { 1000000, 2000000, 3000000, 4000000 };
+uint32_t uartBaudRate = 2000000;
+
+//busy waits for the rx pin to reach level, returns 0 if it doesn't by the deadline
+static inline int autobaudWait(uint32_t level, uint32_t deadline, uint32_t *when) {
+	while ((GPIOA->IDR & GPIO_IDR_IDR9) != level) {
+		if ((int32_t) (DWT->CYCCNT - deadline) > 0)
+			return 0;
+	}
+	*when = DWT->CYCCNT;
+	return 1;
+}
+
+//times the 'U' (0x55) that starts the first frame after the line has been idle and sets BRR to the closest supported rate.
+//gives up after about a millisecond so the main loop keeps running. returns 1 and drops whatever was buffered if the rate changed,
+//2 if the rate measured is the one already in use and nothing was dropped, or 0 if it couldn't tell
+int uartAutobaud() {
+	uint32_t charCycles = SystemCoreClock / autobaudRates[0] * 10;
+	uint32_t deadline = DWT->CYCCNT + SystemCoreClock / 1000;
+	uint32_t now, highSince = DWT->CYCCNT;
+
+	//the line has to be high for a character time at the slowest rate, so the next falling edge is a start bit
+	for (;;) {
+		now = DWT->CYCCNT;
+		if (!(GPIOA->IDR & GPIO_IDR_IDR9))
+			highSince = now;
+		else if (now - highSince >= charCycles)
+			break;
+		if ((int32_t) (now - deadline) > 0)
+			return 0;
+	}
+
+	//0x55 goes out lsb first as start,1,0,1,0,1,0,1,0,stop. the 1st and 5th falling edges are 8 bit times apart.
+	//anything in between would cost us edges at 4Mbps, where each level only lasts 16 cycles
+	uint32_t edges[5];
+	int ok = 1;
+	deadline = DWT->CYCCNT + charCycles * 2;
+	__disable_irq();
+	for (int i = 0; i < 5 && ok; i++) {
+		ok = autobaudWait(0, deadline, &edges[i]);
+		if (ok && i < 4)
+			ok = autobaudWait(GPIO_IDR_IDR9, deadline, &now);
+	}
+	__enable_irq();
+	if (!ok)
+		return 0;
+
+	//every pair of bits should take about the same time, or this wasn't a 'U'
+	uint32_t span = edges[4] - edges[0];
+	for (int i = 0; i < 4; i++) {
+		int32_t error = (int32_t) (edges[i + 1] - edges[i]) * 4 - (int32_t) span;
+		if (error < 0)
+			error = -error;
+		if ((uint32_t) error > span / 3)
+			return 0;
+	}
+
+	uint32_t best = 0, bestError = span;
+	for (int i = 0; i < (int) (sizeof(autobaudRates) / sizeof(autobaudRates[0])); i++) {
+		int32_t error = (int32_t) (SystemCoreClock / autobaudRates[i] * 8) - (int32_t) span;
+		if (error < 0)
+			error = -error;
+		if ((uint32_t) error < bestError) {
+			bestError = error;
+			best = autobaudRates[i];
+		}
+	}
+	//not close to any of them, probably noise
+	if (bestError > span / 8)
+		return 0;
+
+	//lock was never lost, what's buffered is good
+	if (best == uartBaudRate)
+		return 2;
+
+	LL_USART_Disable(USART1);
+	LL_USART_SetBaudRate(USART1, SystemCoreClock, best);
+	LL_USART_Enable(USART1);
+	uartBaudRate = best;
+
+	//anything buffered so far was read at the wrong rate
+	__disable_irq();
+	uartConsumed = uartHead();
+	idleTail = idleHead;
+	__enable_irq();
+	uartPos = uartConsumed % UART_BUF_SIZE;
+	return 1;
+}
+#endif
+
 void uartIsr() {
+	uint32_t sr = USART1->SR;
 	//check all the uart error conditions
-	if (USART1->SR & (USART_SR_FE | USART_SR_ORE | USART_SR_NE)) {
+	if (sr & (USART_SR_FE | USART_SR_ORE | USART_SR_NE)) {
 		//we don't really care to handle the error in any special way
 		//the various checks and CRC should toss bad frames
 		//this is more for debugging purposes and to clear the error bits
 		uartErrors++;
+	}
+
+#if UART_IDLE_ABORT
+	//the line has been quiet for a character time, whatever dma has written so far is the end of a burst.
+	//the flag is set even with its interrupt off, so an error interrupt would see it too
+	if (sr & USART_SR_IDLE) {
+		uint8_t pending = idleHead - idleTail;
+		if (pending < UART_IDLE_MARKS) {
+			idleMarks[idleHead % UART_IDLE_MARKS] = uartHead();
+			idleHead++;
+		}
+	}
+#endif
 
+	if (sr & (USART_SR_FE | USART_SR_ORE | USART_SR_NE | USART_SR_IDLE)) {
 		//for stm32f103 this is the magic sequence that clears all of those bits
 		__IO uint32_t tmpreg;
 		//already read during check above
@@ -94,6 +234,58 @@ void uartIsr() {
 
 }
 
+//dma has filled half of the buffer, either the first half or all of it. checks how far behind the parser is
+//right as dma starts on the other half
+static void uartHalfDone(uint32_t head) {
+	uint32_t lag = head - uartConsumed;
+	if (lag > uartStats.highWater)
+		uartStats.highWater = lag > 0xffff ? 0xffff : lag;
+	if (lag <= UART_BUF_SIZE) {
+		uartLapped = 0;
+	} else if (!uartLapped) {
+		//dma went past the parser and wrote over data it hadn't read yet. mark it like the line went idle
+		//so the parser drops the frame and picks up from here. once it skips to the mark it's caught up again
+		uartLapped = 1;
+		uartStats.overruns++;
+		uint8_t pending = idleHead - idleTail;
+		if (pending < UART_IDLE_MARKS) {
+			idleMarks[idleHead % UART_IDLE_MARKS] = head;
+			idleHead++;
+		}
+	}
+}
+
+void uartDmaIsr() {
+	uint32_t isr = DMA1->ISR;
+	if (isr & DMA_ISR_HTIF5) {
+		DMA1->IFCR = DMA_IFCR_CHTIF5;
+		uartHalfDone(uartWraps * UART_BUF_SIZE + UART_BUF_SIZE / 2);
+	}
+	if (isr & DMA_ISR_TCIF5) {
+		DMA1->IFCR = DMA_IFCR_CTCIF5;
+		uartWraps++;
+		uartHalfDone(uartWraps * UART_BUF_SIZE);
+	}
+}
+
+#if CRC_ENGINE == CRC_ENGINE_HW
+void uartResetCrc() {
+	CRC->CR = CRC_CR_RESET;
+	crcTail = 0;
+	crcTailBytes = 0;
+}
+
+uint32_t uartGetCrc() {
+	//pick up where the crc unit left off and finish any partial word in software
+	crc_t c = __RBIT(CRC->DR);
+	uint32_t tail = crcTail;
+	for (int i = 0; i < crcTailBytes; i++) {
+		c = crc_table[(c ^ tail) & 0xff] ^ (c >> 8);
+		tail >>= 8;
+	}
+	return c ^ 0xffffffff;
+}
+#else
 void uartResetCrc() {
 	crc = 0xffffffff;
 }
@@ -101,6 +293,7 @@ void uartResetCrc() {
 uint32_t uartGetCrc() {
 	return crc ^ 0xffffffff;
 }
+#endif
 
 void uartRead(void *dst, int size) {
 	uint8_t *p = (uint8_t*) dst;
@@ -108,13 +301,37 @@ void uartRead(void *dst, int size) {
 		*p++ = uartGetc();
 }
 
+//where reading has to stop for now, either the dma head or the next idle mark
+static inline int uartLimit() {
+	if (idleHead != idleTail)
+		return idleMarks[idleTail % UART_IDLE_MARKS] % UART_BUF_SIZE;
+	return UART_BUF_SIZE - DMA1_Channel5->CNDTR;
+}
+
+//returns 1 if the line has gone idle and that mark hasn't been skipped yet
+int uartIdlePending() {
+	return idleHead != idleTail;
+}
+
+//drops anything left before the oldest idle mark and moves past it. this also catches up after an overrun
+void uartSkipToIdle() {
+	uartConsumed = idleMarks[idleTail % UART_IDLE_MARKS];
+	uartPos = uartConsumed % UART_BUF_SIZE;
+	idleTail++;
+}
+
 int uartAvailable() {
-	int res = (UART_BUF_SIZE - DMA1_Channel5->CNDTR) - uartPos;
+	int res = uartLimit() - uartPos;
 	if (res < 0)
 		res += UART_BUF_SIZE;
 	return res;
 }
 
+//returns the next byte without consuming it, there must be one available
+uint8_t uartPeek() {
+	return uartBuffer[uartPos];
+}
+
 uint8_t uartGetc() {
 	while (uartPos == (UART_BUF_SIZE - DMA1_Channel5->CNDTR)) {
 		//wait
@@ -122,7 +339,31 @@ uint8_t uartGetc() {
 
 	uint8_t res = uartBuffer[uartPos++];
 	crc_update8(res);
+	uartConsumed++;
 	if (uartPos >= UART_BUF_SIZE)
 		uartPos = 0;
 	return res;
 }
+
+//returns how many bytes can be read from *data in one go. stops at the end of the buffer, more may be available after it wraps
+int uartSpan(uint8_t **data) {
+	int head = uartLimit();
+	*data = uartBuffer + uartPos;
+	if (head >= uartPos)
+		return head - uartPos;
+	return UART_BUF_SIZE - uartPos;
+}
+
+//consumes size bytes without adding them to the CRC, they must be available
+void uartSkip(int size) {
+	uartConsumed += size;
+	uartPos += size;
+	if (uartPos >= UART_BUF_SIZE)
+		uartPos -= UART_BUF_SIZE;
+}
+
+//consumes size bytes from the span, adding them to the CRC in one go
+void uartCommit(int size) {
+	crc_update(uartBuffer + uartPos, size);
+	uartSkip(size);
+}
@@ -0,0 +1,81 @@
+//host check that the slice-by-4 CRC gives the same result as the byte at a time table.
+//build and run from this directory with:
+//  gcc -O2 -Wall -I../Core/Inc crcTest.c -o crcTest && ./crcTest
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//app.h needs the mcu headers, these match its values
+#define CRC_ENGINE_SLICE4 2
+#define CRC_ENGINE CRC_ENGINE_SLICE4
+#include "crc32.h"
+
+#define RING_SIZE 128 //the default UART_BUF_SIZE
+#define MAX_FRAME 600
+
+static int failures;
+
+static crc_t crcBytes(const uint8_t *data, int size) {
+	crc_t c = 0xffffffff;
+	while (size--)
+		c = crc32Byte(c, *data++);
+	return c;
+}
+
+static void check(const char *what, int size, int a, int b, crc_t got, crc_t want) {
+	if (got != want) {
+		if (failures++ < 20)
+			printf("FAIL %s size %d (%d, %d): %08lx != %08lx\n", what, size, a, b,
+					(unsigned long) got, (unsigned long) want);
+	}
+}
+
+int main() {
+	//the standard check value
+	const uint8_t check9[] = "123456789";
+	check("check value", 9, 0, 0, crc32Update(0xffffffff, check9, 9) ^ 0xffffffff, 0xcbf43926);
+
+	static uint8_t frame[MAX_FRAME + 4];
+	static uint8_t ring[RING_SIZE];
+	srand(1);
+	for (int n = 0; n < 2000; n++) {
+		int size = n < MAX_FRAME ? n : rand() % MAX_FRAME;
+		for (int i = 0; i < (int) sizeof(frame); i++)
+			frame[i] = rand();
+
+		//every alignment of the data, in one go
+		for (int align = 0; align < 4; align++) {
+			crc_t want = crcBytes(frame + align, size);
+			check("aligned", size, align, 0, crc32Update(0xffffffff, frame + align, size), want);
+		}
+
+		//split in two anywhere, the way the parser commits as much as it has so far
+		crc_t want = crcBytes(frame, size);
+		for (int split = 0; split <= size; split++) {
+			crc_t c = crc32Update(0xffffffff, frame, split);
+			c = crc32Update(c, frame + split, size - split);
+			check("split", size, split, 0, c, want);
+		}
+
+		//starting at every position in the ring, so the frame wraps at every point it can
+		if (size <= RING_SIZE) {
+			for (int start = 0; start < RING_SIZE; start++) {
+				for (int i = 0; i < size; i++)
+					ring[(start + i) % RING_SIZE] = frame[i];
+				int first = RING_SIZE - start;
+				if (first > size)
+					first = size;
+				crc_t c = crc32Update(0xffffffff, ring + start, first);
+				c = crc32Update(c, ring, size - first);
+				check("ring", size, start, first, c, want);
+			}
+		}
+	}
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("crc ok\n");
+	return 0;
+}
@@ -0,0 +1,168 @@
+//host round trip of rleEncode through ws2812Runs, the SET_CHANNEL_WS2812_RLE run loop in app.c, checked against
+//the bitBuffer ws2812Pixels makes from the same pixels for SET_CHANNEL_WS2812. build and run from this directory with:
+//  MCU="-DSTM32F103xB -DUSE_FULL_LL_DRIVER -I../Core/Inc -I../Drivers/STM32F1xx_HAL_Driver/Inc -I../Drivers/CMSIS/Device/ST/STM32F1xx/Include -I../Drivers/CMSIS/Include"
+//  g++ -std=gnu++14 -O2 -w -fpermissive $MCU -c ../Core/Src/bitConverterTpl.cpp -o bitConverter.o
+//  gcc -O2 -w $MCU -I../tools rleTest.c ../tools/rleEncode.c bitConverter.o -o rleTest && ./rleTest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "app.h"
+#include "ws2812Pixels.h"
+#include "rleEncode.h"
+
+static uint32_t plainBuffer[BYTES_PER_CHANNEL * 2];
+static uint32_t rleBuffer[BYTES_PER_CHANNEL * 2];
+static uint8_t pixels[BYTES_PER_CHANNEL];
+static uint8_t runData[RLE_MAX_BYTES(BYTES_PER_CHANNEL, 3)];
+
+static int failures;
+
+//the record being decoded, what app.c keeps in parser
+static uint8_t channel;
+static int numElements;
+static const uint8_t *order;
+static PixelConverter converter;
+
+//where the last wait let the run loop write up to, and where the run it was for starts
+static const uint32_t *waitEnd;
+static const uint32_t *runStart;
+static int badWait;
+
+//in place of drawWait, each run has to wait for all of itself and start where the last one ended
+static void checkWait(const uint32_t *end) {
+	if (end <= waitEnd || end > rleBuffer + BYTES_PER_CHANNEL * 2)
+		badWait = 1;
+	runStart = waitEnd;
+	waitEnd = end;
+}
+
+//in place of ws2812Convert in app.c
+static uint32_t * convert(uint32_t *dst, const uint8_t *data, int count) {
+	if (dst != runStart || dst + count * 2*numElements > waitEnd)
+		badWait = 1;
+	return ws2812Pixels(dst, channel, converter, order, numElements, data, count);
+}
+
+//decodes runs the way recordData does for a record of count pixels, returns badData
+static int rleDecode(const uint8_t *data, int runs, int count) {
+	uint16_t pixelsLeft = count;
+	uint8_t badData = 0;
+	waitEnd = runStart = rleBuffer;
+	badWait = 0;
+	uint32_t *dst = ws2812Runs(rleBuffer, channel, numElements, data, runs, &pixelsLeft, &badData, checkWait, convert);
+	if (dst != waitEnd || pixelsLeft != 0 || dst != rleBuffer + count * 2*numElements)
+		badWait = 1;
+	return badData;
+}
+
+static void setRecord(int elements, uint8_t outputBit, const uint8_t *colorOrder) {
+	numElements = elements;
+	channel = outputBit;
+	order = colorOrder;
+	converter = pixelConverterFor(numElements, order[0], order[1], order[2], order[3]);
+}
+
+static void roundTrip(int test, int count) {
+	//the other channels' data has to come through untouched
+	for (int i = 0; i < BYTES_PER_CHANNEL * 2; i++)
+		plainBuffer[i] = rleBuffer[i] = rand() ^ rand() << 16;
+
+	ws2812Pixels(plainBuffer, channel, converter, order, numElements, pixels, count);
+
+	int runs = rleEncode(runData, pixels, count, numElements);
+	if (runs > count || rleDecode(runData, runs, count)) {
+		if (failures++ < 20)
+			printf("FAIL test %d: %d runs don't make %d pixels\n", test, runs, count);
+		return;
+	}
+	if (badWait) {
+		if (failures++ < 20)
+			printf("FAIL test %d: runs don't wait for the bitBuffer they write\n", test);
+	}
+	if (memcmp(plainBuffer, rleBuffer, sizeof(plainBuffer))) {
+		if (failures++ < 20)
+			printf("FAIL test %d: %d elements, %d pixels in %d runs on channel %d, bitBuffer differs\n",
+					test, numElements, count, runs, channel);
+	}
+}
+
+//runs that add up to more than the record's pixels stop at its last pixel, and the record is thrown out
+static void overrun(int count) {
+	for (int i = 0; i < BYTES_PER_CHANNEL * 2; i++)
+		plainBuffer[i] = rleBuffer[i] = rand() ^ rand() << 16;
+	memset(pixels, 0xa5, count * numElements);
+	ws2812Pixels(plainBuffer, channel, converter, order, numElements, pixels, count);
+
+	int runs = rleEncode(runData, pixels, count, numElements);
+	runData[(runs - 1) * (numElements + 1)] += 2; //the last run goes 2 past the end
+	if (!rleDecode(runData, runs, count) || badWait
+			|| memcmp(plainBuffer, rleBuffer, sizeof(plainBuffer))) {
+		failures++;
+		printf("FAIL runs past %d pixels aren't cut short and flagged\n", count);
+	}
+}
+
+int main() {
+	srand(1);
+	for (int test = 0; test < 2000; test++) {
+		int elements = 3 + (test & 1);
+		int count = rand() % (BYTES_PER_CHANNEL / elements + 1);
+		if (test < 8)
+			count = test; //nothing, and tiny ones
+		static uint8_t colorOrder[4];
+		for (int e = 0; e < 4; e++)
+			colorOrder[e] = e;
+		for (int e = elements - 1; e > 0; e--) {
+			int other = rand() % (e + 1);
+			uint8_t t = colorOrder[e];
+			colorOrder[e] = colorOrder[other];
+			colorOrder[other] = t;
+		}
+		setRecord(elements, rand() % 8, colorOrder);
+
+		//runs of a few colors, some longer than a count byte holds, and some single pixels
+		uint8_t colors[4][4];
+		for (int i = 0; i < (int) sizeof(colors); i++)
+			colors[i / 4][i % 4] = rand();
+		int maxRun = test % 3 == 0 ? 600 : test % 3 == 1 ? 20 : 1;
+		for (int i = 0; i < count;) {
+			int run = 1 + rand() % maxRun;
+			const uint8_t *color = colors[rand() % 4];
+			for (; run && i < count; run--, i++)
+				memcpy(pixels + i * numElements, color, numElements);
+		}
+		if (maxRun == 1) {
+			for (int i = 0; i < count * numElements; i++)
+				pixels[i] = rand();
+		}
+
+		roundTrip(test, count);
+	}
+
+	//the longest runs, a whole channel of one color
+	memset(pixels, 0x5a, sizeof(pixels));
+	static const uint8_t rgb[4] = {0, 1, 2, 3};
+	setRecord(3, 7, rgb);
+	roundTrip(-1, BYTES_PER_CHANNEL / 3);
+	if (rleEncode(runData, pixels, BYTES_PER_CHANNEL / 3, 3) != (BYTES_PER_CHANNEL / 3 + 255) / 256) {
+		failures++;
+		printf("FAIL runs of one color aren't 256 pixels long\n");
+	}
+
+	setRecord(4, 0, rgb);
+	overrun(1);
+	overrun(300);
+	setRecord(3, 5, (const uint8_t[]) {2, 0, 1, 3});
+	converter = 0; //the path for an order without a converter, bitConverter a pixel at a time
+	overrun(300);
+	roundTrip(-2, 300);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("rle ok\n");
+	return 0;
+}
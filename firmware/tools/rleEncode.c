@@ -0,0 +1,18 @@
+#include <string.h>
+#include "rleEncode.h"
+
+int rleEncode(uint8_t *out, const uint8_t *pixels, int count, int numElements) {
+	int runs = 0;
+	for (int i = 0; i < count; runs++) {
+		const uint8_t *pixel = pixels + i * numElements;
+		int n = 1;
+		//a count byte holds up to 256
+		while (i + n < count && n < 256 && !memcmp(pixel, pixel + n * numElements, numElements))
+			n++;
+		*out++ = n - 1;
+		memcpy(out, pixel, numElements);
+		out += numElements;
+		i += n;
+	}
+	return runs;
+}
@@ -0,0 +1,23 @@
+#ifndef __RLE_ENCODE_H__
+#define __RLE_ENCODE_H__
+
+//sender side encoder for SET_CHANNEL_WS2812_RLE records
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//bytes of run data rleEncode can write for count pixels, when no two pixels next to each other match
+#define RLE_MAX_BYTES(count, numElements) ((count) * ((numElements) + 1))
+
+//encodes count pixels of numElements bytes each into runs, a count byte (run length - 1) followed by the pixel.
+//out needs room for RLE_MAX_BYTES. returns the number of runs, which goes in PBRleChannel.runs
+int rleEncode(uint8_t *out, const uint8_t *pixels, int count, int numElements);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif